@@ -34,15 +34,11 @@ void Server::run(uint16_t client_port) noexcept {
     for (int i = 0; i < TOTAL_MESSAGES; ++i) {
       auto recv_task = m_socket.receive_async(buffer);
 
-      if (!recv_task.is_done()) {
-        recv_task.resume();
-      }
+      m_socket.run_until(recv_task);
 
       auto send_task = m_socket.send_async("127.0.0.1", client_port, buffer.data(), recv_task.get_result());
 
-      if (!send_task.is_done()) {
-        send_task.resume();
-      }
+      m_socket.run_until(send_task);
 
       log_info("Server received: ", std::string(buffer.begin(), buffer.begin() + recv_task.get_result()));
 
@@ -83,17 +79,13 @@ void Client::run(uint16_t server_port) noexcept {
     for (int i = 0; i < TOTAL_MESSAGES; ++i) {
       auto send_task = m_socket.send_async("127.0.0.1", server_port, message.c_str(), message.size());
 
-      if (!send_task.is_done()) {
-        send_task.resume();
-      }
+      m_socket.run_until(send_task);
 
       Buffer buffer(32);
 
       auto recv_task = m_socket.receive_async(buffer);
 
-      if (!recv_task.is_done()) {
-        recv_task.resume();
-      }
+      m_socket.run_until(recv_task);
 
       std::string echo(buffer.begin(), buffer.begin() + recv_task.get_result());
 
@@ -5,23 +5,9 @@
 
 using Task = udp::Task<mesh::Node*>;
 
-inline bool udp::Task<mesh::Node*>::await_ready() const noexcept {
-  return false;
-}
-
-inline bool udp::Task<mesh::Node*>::await_suspend(std::coroutine_handle<> handle) {
-  return false;
-}
-
-inline mesh::Node* udp::Task<mesh::Node*>::await_resume() {
-  return m_handle.promise().m_node;
-}
-
-static Task run() {
-  auto node = std::make_shared<mesh::Node>(mesh::Endpoint("127.0.0.1", 8080));
-
+static Task run(std::shared_ptr<mesh::Node> node) {
   /* Subscribe to events */
-  node->subscribe("peer_connected", [](const std::shared_ptr<mesh::events::Event>& event) -> Task {
+  node->subscribe("Peer_connected", [](const std::shared_ptr<mesh::events::Event>& event) -> Task {
     auto peer_event = std::static_pointer_cast<mesh::events::Peer_connected>(event);
 
     log_info("Peer connected: ", peer_event->m_endpoint.to_peer_id());
@@ -29,7 +15,7 @@ static Task run() {
     co_return;
   });
 
-  node->subscribe("message_received", [](const std::shared_ptr<mesh::events::Event>& event) -> Task {
+  node->subscribe("Message_received", [](const std::shared_ptr<mesh::events::Event>& event) -> Task {
     auto msg_event = std::static_pointer_cast<mesh::events::Message_received>(event);
 
     log_info("Message received from: ", msg_event->m_from_peer);
@@ -59,10 +45,19 @@ int main(int argc, char** argv) {
   log_info("Starting UDP mesh example...");
 
   try {
-    auto task = run();
+    /* The handlers only log, they can run off the ring thread. Outlives the node. */
+    udp::Executor executor(2);
+
+    auto node = std::make_shared<mesh::Node>(mesh::Endpoint("127.0.0.1", 8080));
+
+    node->set_executor(executor);
+
+    auto task = run(node);
+
+    /* Drive the node until the example is done */
+    node->run_until(task);
 
-    /* Wait for completion */
-    std::this_thread::sleep_for(std::chrono::seconds(65));
+    task.get_result();
 
   } catch (const std::exception& e) {
     log_error(e.what());
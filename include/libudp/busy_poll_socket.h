@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include "transport.h"
+
+namespace udp {
+
+  struct Busy_poll_config {
+    /* SO_BUSY_POLL, microseconds a receive busy polls the device queue. Values
+     * above net.core.busy_read need CAP_NET_ADMIN. 0 leaves the socket default. */
+    uint32_t m_busy_poll_us{50};
+
+    /* SO_PREFER_BUSY_POLL, keep the device interrupts masked while we poll */
+    bool m_prefer_busy_poll{true};
+
+    /* Max datagrams per recvmmsg/sendmmsg, at most Busy_poll_socket::MAX_BATCH */
+    uint32_t m_batch_size{32};
+  };
+
+  struct Busy_poll_socket;
+
+  /**
+   * An operation queued on a Busy_poll_socket. There is no ring, the socket's
+   * run_once() does the syscalls and completes the operations.
+   */
+  struct Busy_poll_operation : public IO_operation {
+    Busy_poll_operation(Busy_poll_socket* socket, Type type) noexcept
+      : IO_operation(nullptr, type), m_socket(socket) {}
+
+    int reap(io_uring_cqe* cqe) override;
+
+    bool has_deadline() const noexcept {
+      return m_deadline != std::chrono::steady_clock::time_point::max();
+    }
+
+    Busy_poll_socket* m_socket{};
+
+    /* Completes with -ETIMEDOUT if still queued at this time */
+    std::chrono::steady_clock::time_point m_deadline{std::chrono::steady_clock::time_point::max()};
+  };
+
+  struct Busy_poll_receive_operation : public Busy_poll_operation {
+    Busy_poll_receive_operation(Busy_poll_socket* socket, Buffer& buffer) noexcept
+      : Busy_poll_operation(socket, IO_operation::Type::RECEIVE), m_buffer(buffer) {}
+
+    void submit() override;
+
+    Buffer& m_buffer;
+
+    /* The sender, filled in by recvmmsg */
+    sockaddr_in m_from{};
+  };
+
+  struct Busy_poll_send_operation : public Busy_poll_operation {
+    /**
+     * @param[in] segment_size If non-zero every datagram is sent with UDP GSO
+     */
+    Busy_poll_send_operation(Busy_poll_socket* socket, std::span<Outgoing_datagram> datagrams, uint16_t segment_size = 0) noexcept
+      : Busy_poll_operation(socket, IO_operation::Type::SEND), m_datagrams(datagrams), m_segment_size(segment_size) {}
+
+    void submit() override;
+
+    std::span<Outgoing_datagram> m_datagrams;
+    uint16_t m_segment_size{};
+
+    /* Index of the first datagram not sent yet */
+    size_t m_next{};
+    int m_n_sent{};
+  };
+
+  struct Busy_poll_timer_operation : public Busy_poll_operation {
+    Busy_poll_timer_operation(Busy_poll_socket* socket, std::chrono::nanoseconds duration) noexcept
+      : Busy_poll_operation(socket, IO_operation::Type::TIMEOUT) {
+      m_deadline = std::chrono::steady_clock::now() + duration;
+    }
+
+    void submit() override;
+  };
+
+  /**
+   * UDP socket that spins on non-blocking recvmmsg/sendmmsg with SO_BUSY_POLL
+   * instead of going through io_uring. Trades a core for latency, and works on
+   * hosts where io_uring is disabled.
+   */
+  struct Busy_poll_socket : public Transport {
+    static constexpr size_t MAX_BATCH = 64;
+
+    /**
+     * @param[in] port The port to bind to
+     * @param[in] config Busy poll and batching setup
+     */
+    explicit Busy_poll_socket(uint16_t port, const Busy_poll_config& config = {});
+
+    ~Busy_poll_socket() override;
+
+    Busy_poll_socket(const Busy_poll_socket&) = delete;
+    Busy_poll_socket& operator=(const Busy_poll_socket&) = delete;
+
+    Task<int> receive_async(Buffer& buffer) override;
+
+    Task<int> receive_async(Buffer& buffer, sockaddr_in& from) override;
+
+    Task<int> send_async(sockaddr_in addr, const void* data, int n_bytes, uint16_t segment_size = 0) override;
+
+    Task<int> receive_async(Buffer& buffer, std::chrono::steady_clock::time_point deadline) override;
+
+    Task<int> send_async(sockaddr_in addr, const void* data, int n_bytes, std::chrono::steady_clock::time_point deadline) override;
+
+    Task<int> send_async(sockaddr_in addr, std::span<const iovec> iov) override;
+
+    Task<int> send_async(sockaddr_in addr, std::span<const iovec> iov, std::chrono::steady_clock::time_point deadline) override;
+
+    Task<int> send_batch(std::span<Outgoing_datagram> datagrams) override;
+
+    /** Expires from run_once(), which keeps spinning until then. */
+    Task<int> sleep_async(std::chrono::nanoseconds duration) override;
+
+    size_t cancel_all() override;
+
+    /** Thread safe, the handle is resumed by the next poll(). */
+    void post(std::coroutine_handle<> handle) override;
+
+    /** Spin until at least one queued operation completes, returns 0 if none is queued. */
+    size_t run_once() override;
+
+    /**
+     * One non-blocking pass over the queued sends and receives.
+     *
+     * @return the number of operations completed
+     */
+    size_t poll();
+
+    /** Cancel the queued operations and close the socket. */
+    void close() noexcept;
+
+    size_t poll_sends();
+
+    size_t poll_receives();
+
+    size_t poll_timers();
+
+    /** Resume the handles posted from other threads. */
+    size_t poll_posted();
+
+    /** Complete the queued operations whose deadline has passed with -ETIMEDOUT. */
+    size_t expire_deadlines();
+
+    /** Dequeued operation is done, complete it. */
+    void finish(Busy_poll_operation* op, int result) noexcept;
+
+    int m_socket_fd{-1};
+    size_t m_batch_size{};
+
+    /* Waiting operations in submission order */
+    std::deque<Busy_poll_send_operation*> m_sends{};
+    std::deque<Busy_poll_receive_operation*> m_receives{};
+
+    /* Number of queued sends and receives that have a deadline */
+    size_t m_n_deadlines{};
+
+    /* Pending timers, a min-heap on the deadline */
+    std::vector<Busy_poll_timer_operation*> m_timers{};
+
+    /* Handles posted from other threads, m_n_posted lets poll() skip the mutex */
+    std::mutex m_posted_mutex{};
+    std::vector<std::coroutine_handle<>> m_posted{};
+    std::atomic<size_t> m_n_posted{};
+  };
+
+}  // namespace udp
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frame_pool.h"
+#include "transport.h"
+
+namespace udp {
+
+/**
+ * A pool of worker threads that resume coroutines. Every worker has its own deque,
+ * it takes work from the back of its own and, once that is empty, steals from the
+ * front of the others. Handles posted from a worker go to its own deque, handles
+ * posted from other threads are spread round robin.
+ *
+ * Only CPU work belongs here, I/O must be submitted from the thread that drives the
+ * transport: hop back with Transport::schedule() first.
+ */
+struct Executor {
+  struct Worker {
+    std::mutex m_mutex{};
+    std::deque<std::coroutine_handle<>> m_queue{};
+    std::thread m_thread{};
+
+    /* Handles resumed by this worker, and how many of those it stole */
+    std::atomic<uint64_t> m_n_executed{};
+    std::atomic<uint64_t> m_n_stolen{};
+  };
+
+  /** Resumes the awaiting coroutine on one of the workers. */
+  struct Schedule_awaiter {
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      m_executor.post(handle);
+    }
+
+    void await_resume() const noexcept {}
+
+    Executor& m_executor;
+  };
+
+  /**
+   * @param[in] n_workers Number of worker threads, 0 for one per hardware thread
+   */
+  explicit Executor(size_t n_workers = 0);
+
+  ~Executor();
+
+  Executor(const Executor&) = delete;
+  Executor& operator=(const Executor&) = delete;
+
+  /** Queue handle to be resumed on a worker, thread safe. */
+  void post(std::coroutine_handle<> handle);
+
+  /** @return an awaitable that moves the coroutine onto a worker. */
+  Schedule_awaiter schedule() noexcept {
+    return Schedule_awaiter{*this};
+  }
+
+  /** Let the workers drain their queues, then join them. */
+  void stop() noexcept;
+
+  size_t size() const noexcept {
+    return m_workers.size();
+  }
+
+  /** The loop of worker index. */
+  void run(size_t index);
+
+  /** @return a handle from the worker's own deque, or stolen from another, or nullptr. */
+  std::coroutine_handle<> next(size_t index);
+
+  std::vector<std::unique_ptr<Worker>> m_workers{};
+
+  /* Handles queued and not yet taken by a worker */
+  std::atomic<size_t> m_n_queued{};
+  std::atomic<size_t> m_next_worker{};
+  std::atomic<bool> m_running{};
+
+  /* Idle workers sleep here until something is queued */
+  std::mutex m_idle_mutex{};
+  std::condition_variable m_idle_cv{};
+};
+
+/**
+ * Coroutine that starts right away and destroys itself when it finishes, for
+ * work handed off to another thread that nobody awaits.
+ */
+struct Detached_task {
+  struct promise_type : public Pooled_frame {
+    Detached_task get_return_object() noexcept {
+      return {};
+    }
+
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+
+    void return_void() noexcept {}
+
+    void unhandled_exception() noexcept {
+      std::terminate();
+    }
+  };
+};
+
+/**
+ * Joins a fan-out: the awaiter suspends until arrive() was called n times and is
+ * then resumed on the transport's thread, whichever thread arrived last.
+ */
+struct Fan_in {
+  /**
+   * @param[in] transport The transport whose thread the awaiter resumes on
+   * @param[in] n Number of arrivals to wait for
+   */
+  Fan_in(Transport& transport, size_t n) noexcept
+    : m_transport(transport), m_n_pending(n + 1) {}
+
+  /**
+   * Thread safe. The caller must not touch the Fan_in after this returns, the
+   * awaiter may already have resumed and destroyed it.
+   */
+  void arrive() {
+    if (m_n_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      m_transport.post(m_continuation);
+    }
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  /* The count starts at n + 1, so nobody arrives last before the continuation is set. */
+  bool await_suspend(std::coroutine_handle<> handle) noexcept {
+    m_continuation = handle;
+
+    return m_n_pending.fetch_sub(1, std::memory_order_acq_rel) != 1;
+  }
+
+  void await_resume() const noexcept {}
+
+  Transport& m_transport;
+  std::atomic<size_t> m_n_pending;
+  std::coroutine_handle<> m_continuation{};
+};
+
+} // namespace udp
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace udp {
+
+/**
+ * Per-thread freelists of coroutine frames, one per size class. A frame freed on
+ * a thread goes to that thread's lists, all blocks come from the global operator
+ * new so they can migrate between threads. Frames larger than MAX_POOLED_SIZE and
+ * frees beyond MAX_FREE_BLOCKS per class go straight to the global allocator.
+ */
+struct Frame_pool {
+  /* Size classes are multiples of this */
+  static constexpr size_t GRANULARITY = 64;
+
+  static constexpr size_t MAX_POOLED_SIZE = 4096;
+
+  static constexpr size_t N_SIZE_CLASSES = MAX_POOLED_SIZE / GRANULARITY;
+
+  /* Bound on the idle blocks kept per class and thread */
+  static constexpr size_t MAX_FREE_BLOCKS = 1024;
+
+  struct Stats {
+    /* Allocations served from a freelist */
+    uint64_t m_n_hits{};
+
+    /* Allocations of a poolable size that had to call operator new */
+    uint64_t m_n_misses{};
+
+    /* Allocations larger than MAX_POOLED_SIZE */
+    uint64_t m_n_oversized{};
+
+    double hit_rate() const noexcept {
+      const auto n_pooled = m_n_hits + m_n_misses;
+
+      return n_pooled == 0 ? 0.0 : double(m_n_hits) / double(n_pooled);
+    }
+  };
+
+  Frame_pool() = default;
+
+  ~Frame_pool();
+
+  Frame_pool(const Frame_pool&) = delete;
+  Frame_pool& operator=(const Frame_pool&) = delete;
+
+  static void* allocate(size_t n_bytes);
+
+  static void deallocate(void* ptr, size_t n_bytes) noexcept;
+
+  /** @return the calling thread's counters. */
+  static const Stats& stats() noexcept;
+
+  static Frame_pool& this_thread() noexcept;
+
+  struct Free_block {
+    Free_block* m_next;
+  };
+
+  struct Free_list {
+    Free_block* m_head{};
+    size_t m_n_blocks{};
+  };
+
+  std::array<Free_list, N_SIZE_CLASSES> m_free_lists{};
+  Stats m_stats{};
+};
+
+/**
+ * Base of the coroutine promise types, allocates their frames from the Frame_pool.
+ */
+struct Pooled_frame {
+  static void* operator new(size_t n_bytes) {
+    return Frame_pool::allocate(n_bytes);
+  }
+
+  static void operator delete(void* ptr, size_t n_bytes) noexcept {
+    Frame_pool::deallocate(ptr, n_bytes);
+  }
+};
+
+} // namespace udp
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "task.h"
+
+struct io_uring;
+
+namespace udp {
+
+/**
+ * The completion side of an io_uring. Drains the CQ in batches and hands every
+ * CQE to the IO_operation stored in its user_data, which resumes the coroutine
+ * that awaits it. Any number of operations can be in flight on the ring, they
+ * complete in whatever order the kernel finishes them.
+ *
+ * One reactor per ring, driven from a single thread.
+ */
+struct Reactor {
+  /* Maximum number of CQEs reaped with one io_uring_peek_batch_cqe */
+  static constexpr size_t BATCH_SIZE = 64;
+
+  explicit Reactor(io_uring* ring) noexcept : m_ring(ring) {}
+
+  /**
+   * Start counting the operations in flight from the ring's current state, must
+   * be called once the ring is set up.
+   */
+  void attach(io_uring* ring) noexcept;
+
+  /**
+   * @return the number of SQEs submitted whose last CQE (the one without
+   *         IORING_CQE_F_MORE) hasn't been dispatched yet.
+   */
+  uint32_t in_flight() const noexcept;
+
+  /**
+   * Dispatch the completions that are ready, never blocks.
+   *
+   * @return the number of CQEs dispatched
+   */
+  size_t poll();
+
+  /**
+   * Wait for at least one completion and dispatch all that are ready.
+   *
+   * @return the number of CQEs dispatched
+   */
+  size_t run_once();
+
+  /**
+   * Start the task if it hasn't started yet and dispatch completions until it
+   * has finished. The task must be waiting on an operation of this ring,
+   * otherwise this never returns.
+   */
+  template<typename T>
+  void run_until(T& task) {
+    task.start();
+
+    while (!task.is_done()) {
+      run_once();
+    }
+  }
+
+  io_uring* m_ring{};
+
+  /* SQ tail when the reactor was attached, SQEs submitted since count as in flight */
+  uint32_t m_sq_tail_base{};
+
+  /* Number of final CQEs dispatched since the reactor was attached */
+  uint32_t m_n_finished{};
+};
+
+} // namespace udp
@@ -1,37 +1,204 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <linux/time_types.h>
 #include <memory>
+#include <mutex>
 #include <netinet/in.h>
+#include <span>
+#include <sys/socket.h>
 #include <string>
 #include <vector>
 
+#include "reactor.h"
 #include "task.h"
+#include "transport.h"
 
 struct io_uring;
+struct io_uring_buf_ring;
+struct io_uring_sqe;
 
 namespace udp {
 
-  using Buffer = std::vector<uint8_t>;
+  /**
+   * Completion handling of sends that may be zero-copy. A zero-copy send posts its
+   * result with IORING_CQE_F_MORE set and a IORING_CQE_F_NOTIF CQE once the kernel
+   * no longer references the buffer. A regular send posts only the result.
+   */
+  struct Notified_send_operation : public IO_operation {
+    using IO_operation::IO_operation;
 
-  struct Send_operation : public IO_operation {
-    Send_operation(io_uring* ring, int fd, const void* data, int n_bytes, const sockaddr_in& addr) noexcept
-      : IO_operation(ring, IO_operation::Type::SEND), m_fd(fd), m_n_bytes(n_bytes), m_data(data), m_addr(addr) {
+    void on_completion(io_uring_cqe* cqe) override;
 
+    /** Called when the send is done and the buffer may be reused. */
+    virtual void sent(int result) {
+      complete(result);
+    }
+
+    /* Result of the send, valid once the first CQE arrived */
+    int m_send_result{};
+    bool m_has_send_result{};
+
+    /* Send with the zero-copy opcode */
+    bool m_zero_copy{};
+  };
+
+  struct Send_operation : public Notified_send_operation {
+    /* Most buffers a gathered send may have, the iovecs are kept in the operation */
+    static constexpr size_t MAX_IOVECS = 8;
+
+    /**
+     * @param[in] segment_size If non-zero the kernel splits the buffer into datagrams
+     *            of this size (UDP GSO), only the last one may be shorter.
+     * @param[in] zero_copy Use IORING_OP_SENDMSG_ZC instead of IORING_OP_SENDMSG
+     */
+    Send_operation(io_uring* ring, int fd, const void* data, int n_bytes, const sockaddr_in& addr, uint16_t segment_size = 0, bool zero_copy = false) noexcept
+      : Notified_send_operation(ring, IO_operation::Type::SEND), m_fd(fd), m_n_bytes(n_bytes), m_segment_size(segment_size), m_addr(addr), m_data(data) {
+
+      m_zero_copy = zero_copy;
       m_iov[0].iov_len = m_n_bytes;
       m_iov[0].iov_base = const_cast<void*>(m_data);
     }
 
+    /**
+     * Gather the datagram from several buffers, the iovecs are copied.
+     *
+     * @param[in] iov At most MAX_IOVECS buffers
+     */
+    Send_operation(io_uring* ring, int fd, std::span<const iovec> iov, const sockaddr_in& addr, bool zero_copy = false) noexcept
+      : Notified_send_operation(ring, IO_operation::Type::SEND), m_fd(fd), m_n_bytes(int(iov_length(iov))), m_addr(addr), m_data(nullptr), m_n_iov(iov.size()) {
+
+      m_zero_copy = zero_copy;
+      assert(m_n_iov <= MAX_IOVECS);
+      std::copy(iov.begin(), iov.end(), m_iov.begin());
+    }
+
     void submit() override;
     int reap(io_uring_cqe* cqe) override;
 
     int m_fd{-1};
     int m_n_bytes;
+    uint16_t m_segment_size{};
     msghdr m_msg_hdr{};
     sockaddr_in m_addr;
     const void* m_data;
-    std::array<iovec, 1> m_iov;
+    size_t m_n_iov{1};
+    std::array<iovec, MAX_IOVECS> m_iov;
+
+    /* UDP_SEGMENT control message */
+    alignas(cmsghdr) std::array<uint8_t, CMSG_SPACE(sizeof(uint16_t))> m_control{};
+  };
+
+  /**
+   * Queues one sendmsg SQE per datagram and submits them all with a single
+   * io_uring_submit (or one per full SQ ring for batches deeper than the ring).
+   */
+  struct Batch_send_operation : public IO_operation {
+    /* Per datagram state, its address is the user_data of the SQE. */
+    struct Slot : public Notified_send_operation {
+      Slot(io_uring* ring, Batch_send_operation* batch, size_t index) noexcept
+        : Notified_send_operation(ring, IO_operation::Type::SEND), m_batch(batch), m_index(index) {}
+
+      void submit() override;
+      int reap(io_uring_cqe* cqe) override;
+
+      /* Completes the batch when the last slot is done. */
+      void sent(int result) override;
+
+      Batch_send_operation* m_batch{};
+      size_t m_index{};
+      msghdr m_msg_hdr{};
+      std::array<iovec, 1> m_iov{};
+    };
+
+    Batch_send_operation(io_uring* ring, int fd, std::span<Outgoing_datagram> datagrams);
+
+    void submit() override;
+    int reap(io_uring_cqe* cqe) override;
+
+    int m_fd{-1};
+    std::span<Outgoing_datagram> m_datagrams;
+    std::vector<Slot> m_slots{};
+
+    /* Number of CQEs still to arrive */
+    size_t m_n_pending{};
+  };
+
+  /**
+   * The datagrams carried by one receive. With UDP GRO the kernel coalesces
+   * datagrams of the same flow into one buffer, all of them segment_size bytes
+   * except possibly the last one. Views into the buffer, nothing is copied.
+   */
+  struct Datagram_segments {
+    struct Iterator {
+      using value_type = std::span<const uint8_t>;
+      using difference_type = std::ptrdiff_t;
+
+      value_type operator*() const noexcept {
+        return (*m_segments)[m_index];
+      }
+
+      Iterator& operator++() noexcept {
+        ++m_index;
+        return *this;
+      }
+
+      Iterator operator++(int) noexcept {
+        auto it = *this;
+        ++m_index;
+        return it;
+      }
+
+      bool operator==(const Iterator& rhs) const noexcept {
+        return m_index == rhs.m_index;
+      }
+
+      const Datagram_segments* m_segments{};
+      size_t m_index{};
+    };
+
+    Datagram_segments() = default;
+
+    /**
+     * @param[in] data The received bytes
+     * @param[in] segment_size The GRO segment size, 0 if the datagrams were not coalesced
+     */
+    Datagram_segments(std::span<const uint8_t> data, size_t segment_size) noexcept
+      : m_data(data), m_segment_size(segment_size == 0 ? data.size() : segment_size) {}
+
+    size_t size() const noexcept {
+      return m_segment_size == 0 ? 0 : (m_data.size() + m_segment_size - 1) / m_segment_size;
+    }
+
+    std::span<const uint8_t> operator[](size_t i) const noexcept {
+      assert(i < size());
+
+      const auto offset = i * m_segment_size;
+
+      return m_data.subspan(offset, std::min(m_segment_size, m_data.size() - offset));
+    }
+
+    Iterator begin() const noexcept {
+      return {this, 0};
+    }
+
+    Iterator end() const noexcept {
+      return {this, size()};
+    }
+
+    std::span<const uint8_t> m_data{};
+    size_t m_segment_size{};
   };
 
+  /* Room for the UDP_GRO control message (an int) on receive. */
+  constexpr size_t GRO_CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+
   struct Receive_operation : public IO_operation {
     Receive_operation(io_uring* ring, int fd, Buffer& buffer) noexcept
       : IO_operation(ring, IO_operation::Type::RECEIVE), m_fd(fd), m_buffer(buffer) {
@@ -50,33 +217,668 @@ namespace udp {
     msghdr m_msg_hdr{};
     sockaddr_in m_client_addr;
     std::array<iovec, 1> m_iov;
+
+    /* GRO segment size of the last receive, 0 if it was a single datagram */
+    uint16_t m_segment_size{};
+    alignas(cmsghdr) std::array<uint8_t, GRO_CONTROL_SIZE> m_control{};
+  };
+
+  /**
+   * Completes after a relative timeout (IORING_OP_TIMEOUT), no thread blocks and
+   * nothing spins while it is pending.
+   */
+  struct Timeout_operation : public IO_operation {
+    Timeout_operation(io_uring* ring, std::chrono::nanoseconds duration) noexcept
+      : IO_operation(ring, IO_operation::Type::TIMEOUT) {
+
+      m_ts.tv_sec = duration.count() / 1'000'000'000;
+      m_ts.tv_nsec = duration.count() % 1'000'000'000;
+    }
+
+    void submit() override;
+
+    /** @return 0 when the timeout expired, -errno otherwise */
+    int reap(io_uring_cqe* cqe) override;
+
+    __kernel_timespec m_ts{};
+  };
+
+  /**
+   * IORING_OP_LINK_TIMEOUT linked to another operation's SQE with IOSQE_IO_LINK.
+   * If the deadline passes first the kernel cancels the operation, which then
+   * completes with -ECANCELED and this with -ETIME. Both CQEs always arrive, in
+   * any order, the owner must await reaped() before the timeout goes away.
+   */
+  struct Link_timeout_operation : public IO_operation {
+    /**
+     * @param[in] deadline Absolute, on CLOCK_MONOTONIC which is the steady_clock
+     */
+    explicit Link_timeout_operation(std::chrono::steady_clock::time_point deadline) noexcept
+      : IO_operation(nullptr, IO_operation::Type::TIMEOUT) {
+
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+
+      m_ts.tv_sec = ns / 1'000'000'000;
+      m_ts.tv_nsec = ns % 1'000'000'000;
+    }
+
+    /** Submitted by the linked operation, see link(). */
+    void submit() override {}
+
+    int reap(io_uring_cqe* cqe) override;
+
+    /**
+     * Queue the timeout behind sqe, must be called after sqe is prepared and
+     * before it is submitted.
+     */
+    void link(io_uring* ring, io_uring_sqe* sqe);
+
+    /** @return true if the timeout expired and cancelled the operation. */
+    bool is_expired() const noexcept {
+      return m_completed && m_result == -ETIME;
+    }
+
+    /** Awaitable that resumes once the timeout's CQE has been reaped. */
+    auto reaped() noexcept {
+      struct Awaiter {
+        bool await_ready() const noexcept {
+          return m_timeout.m_completed;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+          m_timeout.m_handle = handle;
+        }
+
+        void await_resume() const noexcept {}
+
+        Link_timeout_operation& m_timeout;
+      };
+
+      return Awaiter{*this};
+    }
+
+    __kernel_timespec m_ts{};
+  };
+
+  /**
+   * IORING_OP_ASYNC_CANCEL of every request on the ring (IORING_ASYNC_CANCEL_ANY |
+   * IORING_ASYNC_CANCEL_ALL). Completes with the number of requests cancelled or
+   * -ENOENT if there was none.
+   */
+  struct Cancel_operation : public IO_operation {
+    explicit Cancel_operation(io_uring* ring) noexcept
+      : IO_operation(ring, IO_operation::Type::NONE) {}
+
+    void submit() override;
+    int reap(io_uring_cqe* cqe) override;
   };
 
-  struct Completion_operation : public IO_operation {
-    Completion_operation(io_uring* ring) noexcept : IO_operation(ring, IO_operation::Type::COMPLETION) {}
+  /**
+   * Resumes coroutines posted from other threads on the ring's thread. post()
+   * queues the handle and writes an eventfd, the ring keeps a read of it in flight
+   * and resumes everything queued when it completes.
+   */
+  struct Post_operation : public IO_operation {
+    /** Creates the eventfd, the read is armed by submit(). */
+    explicit Post_operation(io_uring* ring);
+
+    ~Post_operation() override;
+
+    Post_operation(const Post_operation&) = delete;
+    Post_operation& operator=(const Post_operation&) = delete;
+
+    /** Queue handle and wake the ring, thread safe. */
+    void post(std::coroutine_handle<> handle);
 
     void submit() override;
     int reap(io_uring_cqe* cqe) override;
+
+    /** Rearms the read, then resumes the queued handles. */
+    void on_completion(io_uring_cqe* cqe) override;
+
+    int m_fd{-1};
+    uint64_t m_value{};
+    bool m_is_armed{};
+    std::mutex m_mutex{};
+    std::vector<std::coroutine_handle<>> m_handles{};
+  };
+
+  struct Registered_buffer;
+
+  /**
+   * Send buffers registered with the ring (io_uring_register_buffers). The pages
+   * are pinned once at registration instead of on every send.
+   *
+   * Not thread safe, buffers must be acquired and released on the ring's thread.
+   */
+  struct Registered_buffer_pool {
+    /**
+     * @param[in] ring The io_uring instance to register the buffers with
+     * @param[in] n_buffers Number of buffers in the pool
+     * @param[in] buffer_size Size of each buffer in bytes
+     */
+    Registered_buffer_pool(io_uring* ring, uint16_t n_buffers, uint32_t buffer_size);
+
+    ~Registered_buffer_pool();
+
+    Registered_buffer_pool(const Registered_buffer_pool&) = delete;
+    Registered_buffer_pool& operator=(const Registered_buffer_pool&) = delete;
+
+    /**
+     * @return a free buffer, the returned buffer is invalid if all of them are in use.
+     */
+    Registered_buffer acquire() noexcept;
+
+    void release(uint16_t buffer_index) noexcept {
+      assert(buffer_index < m_n_buffers);
+      m_free.push_back(buffer_index);
+    }
+
+    io_uring* m_ring{};
+    uint16_t m_n_buffers{};
+    uint32_t m_buffer_size{};
+    Buffer m_storage{};
+    std::vector<uint16_t> m_free{};
   };
 
-  struct Socket {
+  /** A buffer from a Registered_buffer_pool, returned to the pool on destruction. */
+  struct Registered_buffer {
+    Registered_buffer() = default;
+
+    Registered_buffer(Registered_buffer_pool* pool, uint16_t buffer_index, std::span<uint8_t> data) noexcept
+      : m_pool(pool), m_buffer_index(buffer_index), m_data(data) {}
+
+    ~Registered_buffer() {
+      release();
+    }
+
+    Registered_buffer(const Registered_buffer&) = delete;
+    Registered_buffer& operator=(const Registered_buffer&) = delete;
+
+    Registered_buffer(Registered_buffer&& rhs) noexcept
+      : m_pool(rhs.m_pool), m_buffer_index(rhs.m_buffer_index), m_data(rhs.m_data) {
+      rhs.m_pool = nullptr;
+      rhs.m_data = {};
+    }
+
+    Registered_buffer& operator=(Registered_buffer&& rhs) noexcept {
+      if (this != &rhs) {
+        release();
+
+        m_pool = rhs.m_pool;
+        m_buffer_index = rhs.m_buffer_index;
+        m_data = rhs.m_data;
+
+        rhs.m_pool = nullptr;
+        rhs.m_data = {};
+      }
+      return *this;
+    }
+
+    bool is_valid() const noexcept {
+      return m_pool != nullptr;
+    }
+
+    std::span<uint8_t> data() const noexcept {
+      return m_data;
+    }
+
+    void release() noexcept {
+      if (m_pool != nullptr) {
+        m_pool->release(m_buffer_index);
+        m_pool = nullptr;
+        m_data = {};
+      }
+    }
+
+    Registered_buffer_pool* m_pool{};
+    uint16_t m_buffer_index{};
+    std::span<uint8_t> m_data{};
+  };
+
+  /**
+   * Sends from a registered buffer with IORING_OP_SEND_ZC and IORING_RECVSEND_FIXED_BUF,
+   * the sendmsg equivalent that accepts a fixed buffer. The kernel posts the send
+   * result (with IORING_CQE_F_MORE) and later a IORING_CQE_F_NOTIF CQE once it no
+   * longer references the buffer, the operation completes after both.
+   */
+  struct Fixed_send_operation : public Notified_send_operation {
+    /**
+     * @param[in] zero_copy Use IORING_OP_SEND_ZC, otherwise a copying IORING_OP_SEND
+     *            from the registered buffer's memory
+     */
+    Fixed_send_operation(io_uring* ring, int fd, const Registered_buffer& buffer, int n_bytes, const sockaddr_in& addr, bool zero_copy = true) noexcept
+      : Notified_send_operation(ring, IO_operation::Type::SEND), m_fd(fd), m_n_bytes(n_bytes), m_buffer(buffer), m_addr(addr) {
+      m_zero_copy = zero_copy;
+    }
+
+    void submit() override;
+    int reap(io_uring_cqe* cqe) override;
+
+    int m_fd{-1};
+    int m_n_bytes{};
+    const Registered_buffer& m_buffer;
+    sockaddr_in m_addr{};
+  };
+
+  /**
+   * A ring of receive buffers provided to the kernel (IORING_REGISTER_PBUF_RING).
+   * The kernel picks a free buffer for every datagram it receives, the buffer
+   * is handed back to the ring with recycle() once the caller is done with it.
+   *
+   * Not thread safe, buffers must be recycled on the thread that drives the ring.
+   */
+  struct Buffer_ring {
+    /**
+     * @param[in] ring The io_uring instance to register the buffers with
+     * @param[in] group_id The buffer group id used in IOSQE_BUFFER_SELECT
+     * @param[in] n_buffers Number of buffers in the ring, must be a power of 2
+     * @param[in] buffer_size Size of each buffer in bytes
+     */
+    Buffer_ring(io_uring* ring, uint16_t group_id, uint32_t n_buffers, uint32_t buffer_size);
+
+    ~Buffer_ring();
+
+    Buffer_ring(const Buffer_ring&) = delete;
+    Buffer_ring& operator=(const Buffer_ring&) = delete;
+
+    std::span<uint8_t> buffer(uint16_t buffer_id) noexcept {
+      assert(buffer_id < m_n_buffers);
+      return {m_storage.data() + size_t(buffer_id) * m_buffer_size, m_buffer_size};
+    }
+
+    /** Give the buffer back to the kernel so that it can be filled again. */
+    void recycle(uint16_t buffer_id) noexcept;
+
+    io_uring* m_ring{};
+    io_uring_buf_ring* m_buf_ring{};
+    uint16_t m_group_id{};
+    uint32_t m_n_buffers{};
+    uint32_t m_buffer_size{};
+    Buffer m_storage{};
+  };
+
+  /**
+   * A datagram received into a kernel selected buffer. The lease owns the buffer
+   * until it is released (or destroyed), after that the kernel can reuse it.
+   * Leases must be released before the socket that produced them is closed.
+   */
+  struct Datagram_lease {
+    Datagram_lease() = default;
+
+    Datagram_lease(Buffer_ring* buffer_ring, uint16_t buffer_id, std::span<const uint8_t> data, const sockaddr_in& from, uint16_t segment_size = 0) noexcept
+      : m_buffer_ring(buffer_ring), m_buffer_id(buffer_id), m_segment_size(segment_size), m_data(data), m_from(from) {}
+
+    ~Datagram_lease() {
+      release();
+    }
+
+    Datagram_lease(const Datagram_lease&) = delete;
+    Datagram_lease& operator=(const Datagram_lease&) = delete;
+
+    Datagram_lease(Datagram_lease&& rhs) noexcept
+      : m_buffer_ring(rhs.m_buffer_ring), m_buffer_id(rhs.m_buffer_id), m_segment_size(rhs.m_segment_size), m_data(rhs.m_data), m_from(rhs.m_from) {
+      rhs.m_buffer_ring = nullptr;
+      rhs.m_data = {};
+    }
+
+    Datagram_lease& operator=(Datagram_lease&& rhs) noexcept {
+      if (this != &rhs) {
+        release();
+
+        m_buffer_ring = rhs.m_buffer_ring;
+        m_buffer_id = rhs.m_buffer_id;
+        m_segment_size = rhs.m_segment_size;
+        m_data = rhs.m_data;
+        m_from = rhs.m_from;
+
+        rhs.m_buffer_ring = nullptr;
+        rhs.m_data = {};
+      }
+      return *this;
+    }
+
+    std::span<const uint8_t> data() const noexcept {
+      return m_data;
+    }
+
+    const sockaddr_in& from() const noexcept {
+      return m_from;
+    }
+
+    /** The datagrams in the lease, more than one if GRO coalesced them. */
+    Datagram_segments segments() const noexcept {
+      return {m_data, m_segment_size};
+    }
+
+    /** Return the buffer to the ring, the data must not be accessed afterwards. */
+    void release() noexcept {
+      if (m_buffer_ring != nullptr) {
+        m_buffer_ring->recycle(m_buffer_id);
+        m_buffer_ring = nullptr;
+        m_data = {};
+      }
+    }
+
+    Buffer_ring* m_buffer_ring{};
+    uint16_t m_buffer_id{};
+    uint16_t m_segment_size{};
+    std::span<const uint8_t> m_data{};
+    sockaddr_in m_from{};
+  };
+
+  /**
+   * A single IORING_OP_RECVMSG armed with IORING_RECV_MULTISHOT. Every CQE it
+   * generates carries one datagram in a buffer picked from the Buffer_ring. The
+   * kernel keeps the operation armed for as long as it sets IORING_CQE_F_MORE.
+   */
+  struct Multishot_receive_operation : public IO_operation {
+    Multishot_receive_operation(io_uring* ring, int fd, Buffer_ring& buffer_ring) noexcept
+      : IO_operation(ring, IO_operation::Type::RECEIVE), m_fd(fd), m_buffer_ring(buffer_ring) {}
+
+    /* Arms the operation, a no-op while it is still armed. */
+    void submit() override;
+    int reap(io_uring_cqe* cqe) override;
+
+    /* Reaped datagrams are queued, the waiting coroutine (if any) is resumed. */
+    void on_completion(io_uring_cqe* cqe) override;
+
+    int m_fd{-1};
+    bool m_is_armed{};
+
+    /* Error that terminated the multishot while nobody was waiting */
+    int m_error{};
+    Buffer_ring& m_buffer_ring;
+    msghdr m_msg_hdr{};
+
+    /* Datagrams reaped but not yet handed to a caller. */
+    std::deque<Datagram_lease> m_ready{};
+  };
+
+  /**
+   * io_uring setup parameters of a socket. Flags the kernel rejects are dropped
+   * one at a time (the newest first) until the setup succeeds, see
+   * Socket::m_ring_flags for what was actually used.
+   */
+  struct Socket_config {
+    /* Number of SQ entries */
+    uint32_t m_ring_depth{32};
+
+    /* Number of CQ entries, 0 lets the kernel use twice the ring depth */
+    uint32_t m_cq_size{};
+
+    /* Let a kernel thread poll the SQ (IORING_SETUP_SQPOLL), submits become syscall free */
+    bool m_sqpoll{};
+
+    /* Idle time before the SQPOLL thread goes to sleep */
+    uint32_t m_sqpoll_idle_ms{};
+
+    /* CPU to pin the SQPOLL thread to, -1 to not pin it */
+    int m_sqpoll_cpu{-1};
+
+    /* IORING_SETUP_COOP_TASKRUN, don't interrupt the submitter to run completion work */
+    bool m_coop_taskrun{};
+
+    /* IORING_SETUP_SINGLE_ISSUER, only the thread that created the socket submits */
+    bool m_single_issuer{};
+
+    /* IORING_SETUP_DEFER_TASKRUN, run completion work only when the reactor waits.
+     * Implies m_single_issuer, ignored together with m_sqpoll. */
+    bool m_defer_taskrun{};
+  };
+
+  struct Socket : public Transport {
     using IO_uring = std::unique_ptr<io_uring>;
 
-    explicit Socket(uint16_t port);
+    /* Bound on the rounds of cancel_all(), resumed callers may keep submitting */
+    static constexpr size_t MAX_CANCEL_ROUNDS = 16;
+
+    /**
+     * @param[in] port The port to bind to
+     * @param[in] config Setup of the socket's io_uring
+     */
+    explicit Socket(uint16_t port, const Socket_config& config = {});
 
     ~Socket();
 
-    Task<int> receive_async(Buffer& buffer);
+    Task<int> receive_async(Buffer& buffer) override;
+
+    Task<int> receive_async(Buffer& buffer, sockaddr_in& from) override;
+
+    /**
+     * Receive with a deadline, the receive SQE is linked to an IORING_OP_LINK_TIMEOUT
+     * and the kernel cancels it when the deadline passes.
+     *
+     * @return the number of bytes received, -ETIMEDOUT past the deadline or -errno
+     */
+    Task<int> receive_async(Buffer& buffer, std::chrono::steady_clock::time_point deadline) override;
+
+    /**
+     * Receive into buffer and split the result into the datagrams it carries.
+     * Only returns more than one segment when GRO is enabled.
+     *
+     * @param[in] buffer Receive buffer, with GRO it should be 64KB
+     * @param[out] segments Views into buffer, one per datagram
+     */
+    Task<int> receive_async(Buffer& buffer, Datagram_segments& segments);
+
+    /**
+     * Let the kernel coalesce datagrams of a flow into one receive (UDP_GRO).
+     * Use the receive_async() variants that report segments, otherwise the
+     * datagram boundaries are lost.
+     */
+    void enable_gro();
+
+    /**
+     * Switch the socket to multishot receive. Registers a ring of n_buffers
+     * buffers of buffer_size bytes each, the kernel fills them without a new
+     * SQE per datagram.
+     *
+     * @param[in] n_buffers Number of receive buffers, must be a power of 2
+     * @param[in] buffer_size Size of each buffer, must fit the largest datagram
+     *            plus the io_uring_recvmsg_out header, the source address and
+     *            GRO_CONTROL_SIZE.
+     */
+    void enable_multishot_receive(uint32_t n_buffers, uint32_t buffer_size);
+
+    /**
+     * Receive the next datagram in multishot mode. On success the lease owns the
+     * kernel buffer holding the datagram and the number of bytes is returned,
+     * otherwise -errno. -ENOBUFS means all buffers are leased out, release some
+     * and call again.
+     *
+     * @param[out] lease The received datagram
+     */
+    Task<int> receive_async(Datagram_lease& lease);
+
+    /**
+     * Send a datagram. With a non-zero segment_size the buffer is sent with UDP GSO,
+     * i.e. as n_bytes / segment_size datagrams in one sendmsg. The kernel limits
+     * a GSO send to 64 segments and 64KB in total.
+     *
+     * @return the number of bytes sent or -errno
+     */
+    Task<int> send_async(const std::string& address, uint16_t port, const void* data, int n_bytes, uint16_t segment_size = 0);
+
+    /**
+     * Send a datagram to an address resolved with resolve(), skips parsing the
+     * address on every call.
+     *
+     * @return the number of bytes sent or -errno
+     */
+    Task<int> send_async(sockaddr_in addr, const void* data, int n_bytes, uint16_t segment_size = 0) override;
+
+    /**
+     * Send with a deadline, linked to an IORING_OP_LINK_TIMEOUT like the receive.
+     *
+     * @return the number of bytes sent, -ETIMEDOUT past the deadline or -errno
+     */
+    Task<int> send_async(sockaddr_in addr, const void* data, int n_bytes, std::chrono::steady_clock::time_point deadline) override;
+
+    /** Gathered send of at most Send_operation::MAX_IOVECS buffers, zero-copy on their total size. */
+    Task<int> send_async(sockaddr_in addr, std::span<const iovec> iov) override;
+
+    Task<int> send_async(sockaddr_in addr, std::span<const iovec> iov, std::chrono::steady_clock::time_point deadline) override;
+
+    /**
+     * Send all the datagrams with a single submission, completes when the last
+     * one has completed. The result of each send is stored in its m_result.
+     *
+     * @param[in,out] datagrams The datagrams to send, must stay valid until the task is done
+     *
+     * @return the number of datagrams that were sent successfully
+     */
+    Task<int> send_batch(std::span<Outgoing_datagram> datagrams) override;
 
-    Task<int> send_async(const std::string& address, uint16_t port, const void* data, int n_bytes);
+    /**
+     * Send with IORING_OP_SENDMSG_ZC, the kernel sends from the caller's pages
+     * instead of copying them. A send then completes only after the kernel has
+     * released the buffer. Falls back to regular sendmsg if the kernel doesn't
+     * support it, at setup or on the first send that fails with EOPNOTSUPP.
+     *
+     * @param[in] min_bytes Smaller sends are copied, pinning pages and the extra
+     *            notification CQE cost more than the copy for small payloads.
+     *
+     * @return true if zero-copy sends are enabled
+     */
+    bool enable_zero_copy_send(uint32_t min_bytes = 4096);
 
+    /**
+     * Register the socket as a fixed file (IOSQE_FIXED_FILE) and a pool of send
+     * buffers with the ring. Saves the fd lookup on every SQE and the page pinning
+     * on every send from a registered buffer.
+     *
+     * @param[in] n_buffers Number of registered send buffers
+     * @param[in] buffer_size Size of each send buffer
+     */
+    void enable_registered_resources(uint16_t n_buffers, uint32_t buffer_size);
+
+    /**
+     * @return a registered send buffer, invalid if the pool is exhausted.
+     */
+    Registered_buffer acquire_send_buffer() noexcept {
+      assert(m_send_buffers);
+      return m_send_buffers->acquire();
+    }
+
+    /**
+     * Send the first n_bytes of a registered buffer. Completes when the kernel no
+     * longer references the buffer, so it can be reused right away.
+     *
+     * @return the number of bytes sent or -errno
+     */
+    Task<int> send_async(const std::string& address, uint16_t port, const Registered_buffer& buffer, int n_bytes);
+
+    /** Send the first n_bytes of a registered buffer to an address resolved with resolve(). */
+    Task<int> send_async(sockaddr_in addr, const Registered_buffer& buffer, int n_bytes);
+
+    /**
+     * @return the fd to put in an SQE, the fixed file index once the socket is registered.
+     */
+    int sqe_fd() const noexcept {
+      return m_is_fixed_file ? 0 : m_socket_fd;
+    }
+
+    /**
+     * @return the SQE flags every operation on this socket needs.
+     */
+    uint8_t sqe_flags() const noexcept;
+
+    /**
+     * @return true if a send of n_bytes should be zero-copy.
+     */
+    bool use_zero_copy(int n_bytes) const noexcept {
+      return m_zero_copy_send && uint32_t(n_bytes) >= m_zero_copy_min_bytes;
+    }
+
+    /**
+     * The kernel rejected a zero-copy send with EOPNOTSUPP: send it again copying
+     * and stop using zero-copy on this socket. Only called then, the sends don't
+     * pay for another frame.
+     *
+     * @param[in] timeout The send's linked timeout, nullptr if it has none
+     *
+     * @return the result of the copying send
+     */
+    Task<int> resend_copying(Notified_send_operation& op, Link_timeout_operation* timeout = nullptr);
+
+    /**
+     * Like resend_copying() for a batch: the datagrams whose zero-copy send was
+     * rejected with EOPNOTSUPP are sent again copying, in one batch.
+     *
+     * @return the number of the batch's datagrams sent
+     */
+    Task<int> resend_copying(Batch_send_operation& op);
+
+    /**
+     * Suspend for duration on the socket's ring.
+     *
+     * @return 0 once the time has passed, -errno if the timeout failed
+     */
+    Task<int> sleep_async(std::chrono::nanoseconds duration) override;
+
+    /**
+     * Dispatch this socket's completions until the task is done. Other operations
+     * in flight on the socket complete as their CQEs arrive.
+     */
+    template<typename T>
+    void run_until(Task<T>& task) {
+      m_reactor.run_until(task);
+    }
+
+    size_t run_once() override {
+      return m_reactor.run_once();
+    }
+
+    /**
+     * Cancel all the operations in flight on the socket's ring and dispatch their
+     * completions, their awaiters resume with -ECANCELED. Returns once the kernel
+     * no longer references any of them.
+     *
+     * @return the number of operations cancelled
+     */
+    size_t cancel_all() override;
+
+    /** Thread safe, requires enable_post(). */
+    void post(std::coroutine_handle<> handle) override {
+      assert(m_post);
+      m_post->post(handle);
+    }
+
+    /** Arm the read of the post eventfd if it isn't in flight. */
+    void enable_post() override;
+
+    /** Cancel the operations in flight, then tear down the ring and the socket. */
     void close() noexcept;
 
     Socket& operator=(Socket&& rhs) noexcept;
 
+    /**
+     * Create the ring, falling back to fewer setup flags if the kernel rejects them.
+     *
+     * @return 0 or -errno of the last attempt
+     */
+    int init_ring(const Socket_config& config);
+
     IO_uring m_ring{};
+    Reactor m_reactor{nullptr};
+
+    /* The IORING_SETUP_* flags the ring was created with */
+    uint32_t m_ring_flags{};
     int m_socket_fd{-1};
     bool m_is_initialized{};
+    bool m_is_fixed_file{};
+
+    /* Sends of at least m_zero_copy_min_bytes use IORING_OP_SENDMSG_ZC if set */
+    bool m_zero_copy_send{};
+
+    /* Sends from registered buffers use IORING_OP_SEND_ZC if set, cleared if the kernel or device lacks it */
+    bool m_zero_copy_supported{true};
+    uint32_t m_zero_copy_min_bytes{};
+    std::unique_ptr<Registered_buffer_pool> m_send_buffers{};
+    std::unique_ptr<Buffer_ring> m_buffer_ring{};
+    std::unique_ptr<Multishot_receive_operation> m_multishot_receive{};
+    std::unique_ptr<Post_operation> m_post{};
   };
 
 }  // namespace udp
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "socket.h"
+
+namespace udp {
+
+struct Socket_group_config {
+  /* Number of sockets (and threads), 0 for one per hardware thread */
+  size_t m_n_shards{};
+
+  /* CPU to pin each shard's thread to, shard i uses m_cpus[i % size]. Empty pins shard i to CPU i. */
+  std::vector<int> m_cpus{};
+
+  /* Attach a SO_ATTACH_REUSEPORT_CBPF program that picks the socket by the receiving CPU */
+  bool m_steer_by_cpu{true};
+
+  /* Setup of every shard's ring */
+  Socket_config m_socket_config{};
+
+  /* Multishot receive buffers per shard */
+  uint32_t m_n_buffers{256};
+  uint32_t m_buffer_size{2048};
+};
+
+/**
+ * N sockets bound to the same port with SO_REUSEPORT, each with its own io_uring
+ * and a thread pinned to a core. The kernel spreads the flows across the sockets
+ * (or steers them by CPU with the optional CBPF program) and every datagram is
+ * handled on the thread of the socket that received it.
+ */
+struct Socket_group {
+  /**
+   * Called on the shard's thread for every datagram. The lease is released when
+   * the handler returns, the socket can be used to reply.
+   */
+  using Handler = std::function<void(size_t shard, Socket& socket, const Datagram_lease& lease)>;
+
+  struct Shard {
+    size_t m_index{};
+    int m_cpu{-1};
+    std::thread m_thread{};
+    std::unique_ptr<Socket> m_socket{};
+
+    /* Written by Socket_group::stop() to wake the thread up */
+    int m_wakeup_fd{-1};
+
+    std::atomic<uint64_t> m_n_received{};
+  };
+
+  /**
+   * @param[in] port The port all the sockets bind to
+   * @param[in] handler Called for every received datagram
+   * @param[in] config Number of shards, pinning and socket setup
+   */
+  Socket_group(uint16_t port, Handler handler, const Socket_group_config& config = {});
+
+  ~Socket_group();
+
+  Socket_group(const Socket_group&) = delete;
+  Socket_group& operator=(const Socket_group&) = delete;
+
+  /**
+   * Start the shards one by one, so that shard i is socket i of the reuseport
+   * group, and attach the steering program. Throws if a shard fails to start.
+   */
+  void start();
+
+  /** Wake up all shards and join their threads. */
+  void stop() noexcept;
+
+  size_t size() const noexcept {
+    return m_shards.size();
+  }
+
+  /**
+   * The shard's thread: create and bind the socket, report it via started, then
+   * dispatch datagrams until stopped.
+   */
+  void run(Shard& shard, std::promise<void>& started);
+
+  void attach_steering_program();
+
+  uint16_t m_port{};
+  Handler m_handler{};
+  Socket_group_config m_config{};
+  std::atomic<bool> m_running{};
+  std::vector<std::unique_ptr<Shard>> m_shards{};
+};
+
+} // namespace udp
@@ -2,9 +2,12 @@
 
 #include <any>
 #include <coroutine>
+#include <cstdint>
 #include <stdexcept>
 #include <type_traits>
+#include <utility>
 
+#include "frame_pool.h"
 #include "logger.h"
 
 struct io_uring;
@@ -12,30 +15,95 @@ struct io_uring_cqe;
 
 namespace udp {
 
-template<typename T> struct Task {
-  struct promise_type;
-  using handle_type = std::coroutine_handle<promise_type>;
+struct Link_timeout_operation;
+
+/**
+ * State shared by the promise types of all the tasks. Tasks are lazy: the body
+ * starts running when the task is awaited or start()ed. When it finishes, control
+ * transfers straight to the awaiting coroutine (symmetric transfer), so long
+ * chains of tasks that complete synchronously don't grow the stack.
+ */
+struct Promise_base : public Pooled_frame {
+  /** Resumes the awaiter, if there is one, in place of returning to the resumer. */
+  struct Final_awaiter {
+    bool await_ready() const noexcept {
+      return false;
+    }
 
-  struct promise_type {
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      if (auto continuation = handle.promise().m_continuation; continuation) {
+        return continuation;
+      }
 
-    Task get_return_object() noexcept {
-      return Task(handle_type::from_promise(*this));
+      return std::noop_coroutine();
     }
 
-    std::suspend_never initial_suspend() noexcept {
-      log_debug("Initial suspending task: ", this);
-      return {};
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept {
+    return {};
+  }
+
+  Final_awaiter final_suspend() noexcept {
+    return {};
+  }
+
+  void unhandled_exception() noexcept {
+    m_exception = std::current_exception();
+  }
+
+  /**
+   * Start the coroutine if it hasn't started yet.
+   *
+   * @param[in] handle The task's coroutine
+   *
+   * @return true if it was started by this call
+   */
+  template<typename Promise>
+  static bool start(std::coroutine_handle<Promise> handle) {
+    if (handle && !std::exchange(handle.promise().m_is_started, true)) {
+      handle.resume();
+      return true;
     }
 
-    std::suspend_always final_suspend() noexcept {
-      log_debug("Final suspending task: ", this);
-      return {};
+    return false;
+  }
+
+  /**
+   * Make awaiter the continuation of the task.
+   *
+   * @return the coroutine to transfer to: the task if it hasn't started yet,
+   *         otherwise nothing, the awaiter stays suspended until the task finishes.
+   */
+  template<typename Promise>
+  static std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle, std::coroutine_handle<> awaiter) noexcept {
+    auto& promise = handle.promise();
+
+    promise.m_continuation = awaiter;
+
+    if (std::exchange(promise.m_is_started, true)) {
+      return std::noop_coroutine();
     }
 
-    void unhandled_exception() noexcept {
-      m_exception = std::current_exception();
-      // TODO: Handle unhandled exceptions
-      std::terminate();
+    return handle;
+  }
+
+  /* The coroutine awaiting this task */
+  std::coroutine_handle<> m_continuation{};
+  std::exception_ptr m_exception{};
+  bool m_is_started{};
+};
+
+template<typename T> struct Task {
+  struct promise_type;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  struct promise_type : public Promise_base {
+
+    Task get_return_object() noexcept {
+      return Task(handle_type::from_promise(*this));
     }
 
     template<typename U>
@@ -44,7 +112,6 @@ template<typename T> struct Task {
     }
 
     T m_result;
-    std::exception_ptr m_exception;
   };
 
   Task() noexcept : m_handle(nullptr) {}
@@ -77,14 +144,13 @@ template<typename T> struct Task {
     return *this;
   }
 
-  void resume() {
-    if (m_handle && !m_handle.done()) {
-      m_handle.resume();
-    }
+  /** Run the task up to its first suspension point, without awaiting it. */
+  void start() {
+    Promise_base::start(m_handle);
   }
 
   bool is_done() const noexcept {
-    return m_handle.done();
+    return m_handle && m_handle.done();
   }
 
   T get_result() {
@@ -95,27 +161,29 @@ template<typename T> struct Task {
     }
   }
 
+  bool await_ready() const noexcept {
+    return is_done();
+  }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    return Promise_base::await_suspend(m_handle, awaiter);
+  }
+
+  T await_resume() {
+    return get_result();
+  }
+
   handle_type m_handle{};
 };
 
 template<>
 struct Task<std::any> {
-  struct promise_type {
-    std::exception_ptr exception;
-
+  struct promise_type : public Promise_base {
     Task get_return_object() noexcept {
       return Task(std::coroutine_handle<promise_type>::from_promise(*this));
     }
 
-    std::suspend_never initial_suspend() noexcept { return {}; }
-
-    std::suspend_never final_suspend() noexcept { return {}; }
-
     void return_void() noexcept {}
-
-    void unhandled_exception() noexcept {
-      exception = std::current_exception();
-    }
   };
 
   using handle_type = std::coroutine_handle<promise_type>;
@@ -146,12 +214,32 @@ struct Task<std::any> {
     return *this;
   }
 
+  void start() {
+    Promise_base::start(m_handle);
+  }
+
+  bool is_done() const noexcept {
+    return m_handle && m_handle.done();
+  }
+
   void get_result() {
-    if (m_handle.promise().exception) {
-      std::rethrow_exception(m_handle.promise().exception);
+    if (m_handle.promise().m_exception) {
+      std::rethrow_exception(m_handle.promise().m_exception);
     }
   }
 
+  bool await_ready() const noexcept {
+    return is_done();
+  }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    return Promise_base::await_suspend(m_handle, awaiter);
+  }
+
+  void await_resume() {
+    get_result();
+  }
+
   handle_type m_handle;
 };
 
@@ -162,7 +250,7 @@ struct Task<std::any> {
     NONE,
     SEND,
     RECEIVE,
-    COMPLETION
+    TIMEOUT
   };
 
   using any_handle = std::coroutine_handle<>;
@@ -175,6 +263,7 @@ struct Task<std::any> {
     return false;
   }
 
+  /** Submit the operation and suspend until the Reactor completes it. */
   bool await_suspend(any_handle handle);
 
   int await_resume() {
@@ -188,26 +277,42 @@ struct Task<std::any> {
         return "SEND";
       case Type::RECEIVE:
         return "RECEIVE";
-      case Type::COMPLETION:
-        return "COMPLETION";
+      case Type::TIMEOUT:
+        return "TIMEOUT";
       default:
         return "NONE";
     }
   }
 
-  int reap();
-
   virtual void submit() = 0;
   virtual int reap(io_uring_cqe* cqe) = 0;
 
+  /**
+   * Called by the Reactor for every CQE that carries this operation in its
+   * user_data. Single shot operations complete with the result of reap().
+   */
+  virtual void on_completion(io_uring_cqe* cqe) {
+    complete(reap(cqe));
+  }
+
+  /** Store the result and resume the awaiting coroutine, if there is one. */
   void complete(int result) noexcept {
     m_result = result;
     m_completed = true;
-    m_handle.resume();
+
+    if (auto handle = std::exchange(m_handle, nullptr); handle) {
+      handle.resume();
+    }
   }
 
   int m_result{};
   bool m_completed{};
+
+  /* Added to the flags of every SQE of the operation, e.g. IOSQE_FIXED_FILE */
+  uint8_t m_sqe_flags{};
+
+  /* If set, submitted linked to the operation's SQE and cancels it on expiry */
+  Link_timeout_operation* m_link_timeout{};
   io_uring* m_ring{};
   any_handle m_handle{};
   Type m_type{Type::NONE};
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <netinet/in.h>
+#include <span>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+
+#include "task.h"
+
+namespace udp {
+
+  using Buffer = std::vector<uint8_t>;
+
+  /**
+   * Parse a dotted IPv4 address once, so that hot send paths can reuse the result.
+   *
+   * @param[in] address The IPv4 address, e.g. "127.0.0.1"
+   * @param[in] port The port in host byte order
+   * @param[out] addr The resolved address, in network byte order
+   *
+   * @return false if the address is not a valid IPv4 address
+   */
+  bool resolve(const std::string& address, uint16_t port, sockaddr_in& addr) noexcept;
+
+  /** @return the total length of the buffers in iov. */
+  inline size_t iov_length(std::span<const iovec> iov) noexcept {
+    size_t n_bytes{};
+
+    for (const auto& entry : iov) {
+      n_bytes += entry.iov_len;
+    }
+
+    return n_bytes;
+  }
+
+  /**
+   * One entry of a batched send, m_result is filled in when the batch completes.
+   * The data must stay valid until then, with zero-copy the kernel reads it late.
+   */
+  struct Outgoing_datagram {
+    /** @return the size of the datagram. */
+    int n_bytes() const noexcept {
+      return m_iov.empty() ? m_n_bytes : int(iov_length(m_iov));
+    }
+
+    sockaddr_in m_addr{};
+    const void* m_data{};
+    int m_n_bytes{};
+
+    /* If not empty the datagram is gathered from these instead of m_data, several
+     * datagrams may share them, e.g. a header and a payload sent to many peers */
+    std::span<const iovec> m_iov{};
+
+    /* Bytes sent or -errno */
+    int m_result{};
+  };
+
+  /**
+   * The datagram operations common to all backends: Socket (io_uring) and
+   * Busy_poll_socket (non-blocking recvmmsg/sendmmsg). Tasks returned by a
+   * transport are lazy, they start when awaited or started and only make progress
+   * while its run_once() is called.
+   */
+  struct Transport {
+    virtual ~Transport() = default;
+
+    /**
+     * Receive one datagram into buffer.
+     *
+     * @return the number of bytes received or -errno
+     */
+    virtual Task<int> receive_async(Buffer& buffer) = 0;
+
+    /**
+     * Receive one datagram into buffer and the address it came from.
+     *
+     * @param[out] from The sender, valid if the result is not negative
+     *
+     * @return the number of bytes received or -errno
+     */
+    virtual Task<int> receive_async(Buffer& buffer, sockaddr_in& from) = 0;
+
+    /**
+     * Send a datagram. With a non-zero segment_size the buffer is sent with UDP GSO.
+     *
+     * @return the number of bytes sent or -errno
+     */
+    virtual Task<int> send_async(sockaddr_in addr, const void* data, int n_bytes, uint16_t segment_size = 0) = 0;
+
+    /**
+     * Send one datagram gathered from the buffers in iov (sendmsg), e.g. a header
+     * and a payload that are never copied into one buffer.
+     *
+     * @param[in] iov The buffers, they and the array must stay valid until the task is done
+     *
+     * @return the number of bytes sent or -errno, -EINVAL if there are too many buffers
+     */
+    virtual Task<int> send_async(sockaddr_in addr, std::span<const iovec> iov) = 0;
+
+    /**
+     * Send a gathered datagram, giving up once deadline has passed.
+     *
+     * @return the number of bytes sent, -ETIMEDOUT past the deadline or -errno
+     */
+    virtual Task<int> send_async(sockaddr_in addr, std::span<const iovec> iov, std::chrono::steady_clock::time_point deadline) = 0;
+
+    /**
+     * Receive one datagram, giving up once deadline has passed.
+     *
+     * @return the number of bytes received, -ETIMEDOUT past the deadline or -errno
+     */
+    virtual Task<int> receive_async(Buffer& buffer, std::chrono::steady_clock::time_point deadline) = 0;
+
+    /**
+     * Send a datagram, giving up once deadline has passed.
+     *
+     * @return the number of bytes sent, -ETIMEDOUT past the deadline or -errno
+     */
+    virtual Task<int> send_async(sockaddr_in addr, const void* data, int n_bytes, std::chrono::steady_clock::time_point deadline) = 0;
+
+    /**
+     * Send all the datagrams, the result of each send is stored in its m_result.
+     *
+     * @param[in,out] datagrams The datagrams to send, must stay valid until the task is done
+     *
+     * @return the number of datagrams that were sent successfully
+     */
+    virtual Task<int> send_batch(std::span<Outgoing_datagram> datagrams) = 0;
+
+    /**
+     * Suspend for duration, driven by the same loop as the I/O.
+     *
+     * @return 0 once the time has passed, -errno if the timer failed
+     */
+    virtual Task<int> sleep_async(std::chrono::nanoseconds duration) = 0;
+
+    /**
+     * Cancel every pending operation, their awaiters resume with -ECANCELED.
+     *
+     * @return the number of operations cancelled
+     */
+    virtual size_t cancel_all() = 0;
+
+    /**
+     * Make progress on the pending operations, waits until at least one completes.
+     *
+     * @return the number of operations completed
+     */
+    virtual size_t run_once() = 0;
+
+    /**
+     * Resume handle on the thread that drives the transport, from within run_once().
+     * Thread safe, it is how work handed to an Executor gets back to do I/O.
+     * enable_post() must have been called.
+     */
+    virtual void post(std::coroutine_handle<> handle) = 0;
+
+    /**
+     * Prepare the transport for post(), on the thread that drives it. cancel_all()
+     * cancels the wakeup too, call it again afterwards to keep accepting posts.
+     */
+    virtual void enable_post() {}
+
+    /** @return an awaitable that moves the coroutine onto the transport's thread. */
+    auto schedule() noexcept {
+      struct Awaiter {
+        bool await_ready() const noexcept {
+          return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+          m_transport.post(handle);
+        }
+
+        void await_resume() const noexcept {}
+
+        Transport& m_transport;
+      };
+
+      return Awaiter{*this};
+    }
+
+    /** Start the task if it hasn't started yet and drive the transport until it is done. */
+    template<typename T>
+    void run_until(T& task) {
+      task.start();
+
+      while (!task.is_done()) {
+        run_once();
+      }
+    }
+  };
+
+}  // namespace udp
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "mesh/message.h"
+
+namespace mesh {
+
+/**
+ * Drops messages seen before, keyed by (source id, message id). Every source gets
+ * a sliding window over its last WINDOW_SIZE message ids, a bitmap indexed by the
+ * id modulo the window, like an IPsec anti-replay window. Ids older than the
+ * window are treated as duplicates. Sources live in a fixed open-addressing table
+ * probed by a 64-bit hash of the source id, the id itself is kept inline and
+ * compared so that colliding sources don't share a window. When a probe sequence
+ * is full its least recently used source is evicted. The memory is fixed at
+ * construction, source ids longer than MAX_SOURCE_ID_LENGTH are dropped, no node
+ * sends them.
+ *
+ * Not thread safe, the node checks it on the transport's thread.
+ */
+struct Dedup_cache {
+  /* Message ids tracked per source, a multiple of 64 */
+  static constexpr size_t WINDOW_SIZE = 1024;
+
+  /* Slots looked at before evicting */
+  static constexpr size_t MAX_PROBE = 8;
+
+  struct Stats {
+    /* Duplicates dropped, including those older than the window */
+    uint64_t m_n_hits{};
+
+    /* New messages */
+    uint64_t m_n_misses{};
+
+    /* Of the hits, dropped because they were older than the window */
+    uint64_t m_n_too_old{};
+
+    /* Sources evicted to make room for another one */
+    uint64_t m_n_evictions{};
+
+    double hit_rate() const noexcept {
+      const auto n_checked = m_n_hits + m_n_misses;
+
+      return n_checked == 0 ? 0.0 : double(m_n_hits) / double(n_checked);
+    }
+  };
+
+  struct Source {
+    std::string_view id() const noexcept {
+      return {m_id.data(), m_id_length};
+    }
+
+    /* 0 if the slot is free, hash() never returns it */
+    uint64_t m_hash{};
+
+    /* The source id, compared on a hash match */
+    std::array<char, MAX_SOURCE_ID_LENGTH> m_id{};
+    uint8_t m_id_length{};
+
+    /* Highest message id seen from the source */
+    Message_id m_highest{};
+
+    /* Value of m_n_checked when the source was last seen, for eviction */
+    uint64_t m_last_seen{};
+
+    std::array<uint64_t, WINDOW_SIZE / 64> m_window{};
+  };
+
+  /**
+   * @param[in] n_sources Sources tracked at once, rounded up to a power of 2
+   */
+  explicit Dedup_cache(size_t n_sources = 256);
+
+  /**
+   * Record the message, O(1) amortized.
+   *
+   * @return true if it was seen before and should be dropped
+   */
+  bool is_duplicate(std::string_view source_id, Message_id message_id) noexcept;
+
+  /** @return true if the message was recorded and is still in its source's window, records nothing. */
+  bool contains(std::string_view source_id, Message_id message_id) const noexcept;
+
+  const Stats& stats() const noexcept {
+    return m_stats;
+  }
+
+  /** @return the hash the sources are probed by, never 0. */
+  static uint64_t hash(std::string_view source_id) noexcept;
+
+  /** @return the slot of the source, a free or evicted one if it isn't tracked. */
+  Source& find(uint64_t hash, std::string_view source_id) noexcept;
+
+  std::vector<Source> m_sources{};
+  size_t m_mask{};
+  uint64_t m_n_checked{};
+  Stats m_stats{};
+};
+
+} // namespace mesh
@@ -6,7 +6,9 @@
 #include <unordered_map>
 #include <vector>
 
+#include "libudp/executor.h"
 #include "libudp/task.h"
+#include "mesh/message.h"
 #include "mesh/peer.h"
 #include "mesh/task.h"
 
@@ -38,7 +40,17 @@ struct Message_received : public Event {
     return "Message_received";
   }
 
-  Buffer m_data;
+  /* The datagram, in the node's receive buffer. Stays valid as long as the event
+   * is kept, the node receives into a new buffer when a handler keeps the event. */
+  std::span<const uint8_t> m_data;
+
+  /* The receive buffer m_data points into */
+  std::shared_ptr<const Buffer> m_buffer;
+
+  /* m_data parsed in place, is_valid() is false if it isn't a mesh message */
+  Message_view m_message;
+
+  /* The message's source id, empty if it isn't a mesh message */
   std::string m_from_peer;
 };
 
@@ -68,15 +80,76 @@ struct Dispatcher {
     m_handlers[event_type].push_back(std::move(handler));
   }
 
-  udp::Task<Node*> dispatch(std::shared_ptr<Event>&& event) {
-    if (auto it = m_handlers.find(event->get_type()); it != m_handlers.end()) {
+  /**
+   * Fan the handlers of an event out over executor's workers. They run concurrently
+   * and must co_await transport->schedule() before doing I/O on the transport, the
+   * node's own entry points do that themselves. Must be set before the first
+   * dispatch, nullptr runs the handlers in line again.
+   *
+   * @param[in] executor The workers to run the handlers on
+   * @param[in] transport dispatch() resumes on its thread, enable_post() must have been called
+   */
+  void set_executor(udp::Executor* executor, udp::Transport* transport) noexcept {
+    m_executor = executor;
+    m_transport = transport;
+  }
+
+  /**
+   * Run the event's handlers, one after the other or all at once on the executor.
+   * The task is lazy, the event is taken by value so that it outlives the caller's
+   * expression. With an executor the task resumes on the transport's thread once
+   * every handler is done.
+   */
+  udp::Task<Node*> dispatch(std::shared_ptr<Event> event) {
+    auto it = m_handlers.find(event->get_type());
+
+    if (it == m_handlers.end()) {
+      co_return;
+    }
+
+    if (m_executor == nullptr) {
       for (const auto& handler : it->second) {
-        co_await handler(std::move(event));
+        co_await handler(event);
       }
+      co_return;
     }
+
+    udp::Fan_in fan_in(*m_transport, it->second.size());
+
+    ++m_n_fan_outs;
+
+    for (const auto& handler : it->second) {
+      run_on_executor(*m_executor, handler, event, fan_in);
+    }
+
+    co_await fan_in;
+
+    --m_n_fan_outs;
+  }
+
+  /**
+   * Run one handler on a worker. The handler is copied, subscribe() may reallocate
+   * the vector it lives in meanwhile. Nothing may touch fan_in after arrive().
+   */
+  static udp::Detached_task run_on_executor(udp::Executor& executor, Handler handler, std::shared_ptr<Event> event, udp::Fan_in& fan_in) {
+    co_await executor.schedule();
+
+    try {
+      co_await handler(event);
+    } catch (const std::exception& e) {
+      log_error("Handler of ", event->get_type(), " failed: ", e.what());
+    }
+
+    fan_in.arrive();
   }
 
   std::unordered_map<std::string, std::vector<Handler>> m_handlers{};
+
+  udp::Executor* m_executor{};
+  udp::Transport* m_transport{};
+
+  /* Dispatches waiting for their handlers on the executor, only touched on the transport's thread */
+  size_t m_n_fan_outs{};
 };
 
 } // namespace mesh::events
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <span>
+#include <string>
+#include <unordered_map>
+
+#include "mesh/message.h"
+
+namespace mesh {
+
+/** Identifies a gossip message across the mesh. */
+struct Message_key {
+  bool operator==(const Message_key& rhs) const = default;
+
+  std::string m_source_id{};
+  Message_id m_message_id{};
+};
+
+struct Message_key_hash {
+  size_t operator()(const Message_key& key) const noexcept {
+    return std::hash<std::string>{}(key.m_source_id) ^ (key.m_message_id * 0x9e3779b97f4a7c15ULL);
+  }
+};
+
+/**
+ * The last gossip messages this node originated or delivered, as it pushes them,
+ * so that a GRAFT can be answered with the message. Bounded, the oldest goes first.
+ */
+struct Gossip_store {
+  explicit Gossip_store(size_t capacity = 1024) noexcept : m_capacity(capacity) {}
+
+  /** Keep a copy of the header and the payload, sent together as one datagram. */
+  void insert(const Message_key& key, std::span<const uint8_t> header, std::span<const uint8_t> payload) {
+    if (m_messages.contains(key)) {
+      return;
+    }
+
+    if (m_order.size() == m_capacity) {
+      m_messages.erase(m_order.front());
+      m_order.pop_front();
+    }
+
+    auto& datagram = m_messages[key];
+
+    datagram.reserve(header.size() + payload.size());
+    datagram.insert(datagram.end(), header.begin(), header.end());
+    datagram.insert(datagram.end(), payload.begin(), payload.end());
+
+    m_order.push_back(key);
+  }
+
+  /** @return the datagram, nullptr if it was never stored or has been dropped. */
+  const Buffer* find(const Message_key& key) const noexcept {
+    auto it = m_messages.find(key);
+
+    return it == m_messages.end() ? nullptr : &it->second;
+  }
+
+  size_t m_capacity{};
+  std::unordered_map<Message_key, Buffer, Message_key_hash> m_messages{};
+  std::deque<Message_key> m_order{};
+};
+
+/** A message announced by an IHAVE that hasn't arrived over an eager link yet. */
+struct Missing_message {
+  /* The peer that announced it, it gets the GRAFT */
+  sockaddr_in m_announcer{};
+
+  /* Grafted if the message still hasn't arrived by then */
+  std::chrono::steady_clock::time_point m_deadline{};
+};
+
+} // namespace mesh
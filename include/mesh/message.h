@@ -1,9 +1,12 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <vector>
 #include <span>
 #include <string>
+#include <string_view>
 
 #include <mesh/peer.h>
 
@@ -15,7 +18,15 @@ enum class Message_type : uint8_t {
   Discovery_response = 2,
   Peer_list = 3,
   Data = 4,
-  Heartbeat = 5
+  Heartbeat = 5,
+
+  /* Plumtree control messages, the header names the gossip message they are about */
+  Ihave = 6,
+  Graft = 7,
+  Prune = 8,
+
+  /* Reply to a Heartbeat, echoes its id and payload */
+  Heartbeat_ack = 9
 };
 
 using Message_ttl = uint16_t;
@@ -35,6 +46,14 @@ inline std::string to_string(const Message_type type) noexcept {
       return "Data";
     case Message_type::Heartbeat:
       return "Heartbeat";
+    case Message_type::Ihave:
+      return "Ihave";
+    case Message_type::Graft:
+      return "Graft";
+    case Message_type::Prune:
+      return "Prune";
+    case Message_type::Heartbeat_ack:
+      return "Heartbeat_ack";
     default:
      std::terminate();
   }
@@ -48,7 +67,7 @@ struct Message_header {
             ", m_ttl: " + std::to_string(m_ttl);
   }
 
-  Message_type m_type{Message_type::None};;
+  Message_type m_type{Message_type::None};
   Message_id m_message_id{};
   std::string m_source_id{};
   Message_ttl m_ttl{};
@@ -65,12 +84,78 @@ struct Message {
   Buffer m_payload;
 };
 
+/**
+ * A received message parsed in place, the fields point into the datagram so they
+ * are only valid as long as it is. The wire layout, integers are little-endian
+ * and unaligned:
+ *
+ *   type (1) | message id (8) | source id length (2) | source id | ttl (2) | payload
+ */
+struct Message_view {
+  /* Size of a message with an empty source id and payload */
+  static constexpr size_t MIN_SIZE = sizeof(Message_type) + sizeof(Message_id) + sizeof(uint16_t) + sizeof(Message_ttl);
+
+  /**
+   * Parse the header, the length is validated once and nothing is copied.
+   *
+   * @param[in] data The datagram, must outlive the view
+   *
+   * @return false if data is shorter than the header it announces or the type is unknown
+   */
+  bool parse(std::span<const uint8_t> data) noexcept;
+
+  bool is_valid() const noexcept {
+    return m_type != Message_type::None;
+  }
+
+  /** @return a copy that owns its source id and payload. */
+  Message to_message() const;
+
+  std::string to_string() const noexcept {
+    return "m_type : " + mesh::to_string(m_type) +
+            ", m_message_id: " + std::to_string(m_message_id) +
+            ", m_source_id: " + std::string(m_source_id) +
+            ", m_ttl: " + std::to_string(m_ttl) +
+            ", m_payload_size: " + std::to_string(m_payload.size());
+  }
+
+  Message_type m_type{Message_type::None};
+  Message_id m_message_id{};
+  std::string_view m_source_id{};
+  Message_ttl m_ttl{};
+  std::span<const uint8_t> m_payload{};
+};
+
+/* Source ids are "address:port", this bounds a header built on the stack */
+constexpr size_t MAX_SOURCE_ID_LENGTH = 64;
+
+using Header_bytes = std::array<uint8_t, Message_view::MIN_SIZE + MAX_SOURCE_ID_LENGTH>;
+
+/**
+ * Write a message header in the wire layout of Message_view, so that it can be
+ * sent in front of a payload that is never copied.
+ *
+ * @param[out] out Receives the header
+ *
+ * @return the size of the header, 0 if source_id is longer than MAX_SOURCE_ID_LENGTH
+ */
+size_t encode_header(Message_type type, Message_id message_id, std::string_view source_id, Message_ttl ttl, Header_bytes& out) noexcept;
+
+/* Payload of a Heartbeat, the sender's steady clock when it was sent */
+using Timestamp_bytes = std::array<uint8_t, sizeof(int64_t)>;
+
+void encode_timestamp(std::chrono::steady_clock::time_point time, Timestamp_bytes& out) noexcept;
+
+/** @return false if payload isn't a timestamp */
+bool decode_timestamp(std::span<const uint8_t> payload, std::chrono::steady_clock::time_point& time) noexcept;
+
 struct Serialize {
   Buffer operator()(const Message& msg) const noexcept;
 };
 
 struct Deserialize {
-   Message operator()(const udp::Buffer& buffer) const noexcept;
+  /** @return the message, with type None if buffer doesn't hold a valid one. */
+  Message operator()(const udp::Buffer& buffer) const noexcept;
 };
 
 } // namespace mesh
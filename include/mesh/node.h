@@ -2,53 +2,219 @@
 
 #include <atomic>
 #include <memory>
-#include <shared_mutex>
+#include <optional>
+#include <thread>
 #include <unordered_map>
 
 #include "libudp/socket.h"
+#include "mesh/dedup.h"
+#include "mesh/gossip.h"
+#include "mesh/peer_table.h"
+#include "mesh/rcu.h"
+#include "mesh/timer_wheel.h"
 #include "mesh/events.h"
 
 namespace mesh {
 
 struct Node : public std::enable_shared_from_this<Node> {
+  /* Hops a broadcast may take */
+  static constexpr Message_ttl DEFAULT_TTL = 8;
 
-  explicit Node(const Endpoint& endpoint);
+  /* How long a message announced by an IHAVE may take to arrive before it is grafted */
+  static constexpr std::chrono::milliseconds GRAFT_TIMEOUT{200};
+
+  /* Period of the check for missing messages */
+  static constexpr std::chrono::milliseconds REPAIR_INTERVAL{50};
+
+  /* A peer not heard from for this long is disconnected */
+  static constexpr std::chrono::seconds PEER_TIMEOUT{30};
+
+  /* Period of the liveness check, and the resolution of the peers' deadlines */
+  static constexpr std::chrono::seconds HEALTH_CHECK_INTERVAL{5};
+  static constexpr std::chrono::milliseconds LIVENESS_TICK{100};
+
+  /* Default period of the heartbeats, a reply that takes longer counts as lost */
+  static constexpr std::chrono::seconds HEARTBEAT_INTERVAL{1};
+
+  /**
+   * @param[in] endpoint The address and port the node listens on
+   * @param[in] config Setup of the node's socket ring
+   */
+  explicit Node(const Endpoint& endpoint, const udp::Socket_config& config = {});
+
+  /**
+   * @param[in] endpoint The address and port the node listens on
+   * @param[in] transport The backend to send and receive with, bound to endpoint's port
+   */
+  Node(const Endpoint& endpoint, std::unique_ptr<udp::Transport> transport);
+
+  ~Node();
 
   udp::Task<Node*> start();
 
+  /** Stop the loops, cancels the node's operations in flight instead of waiting for them. */
   udp::Task<Node*> stop();
 
+  /**
+   * Send buffer as the payload of a Data message. The header is gathered in front
+   * of it by the kernel, the payload is never copied.
+   */
   udp::Task<Node*> send_to_peer(const Endpoint& endpoint, const Buffer& buffer);
 
+  /**
+   * Send to the peer, the kernel cancels the send if it hasn't completed by the
+   * deadline. Throws Timeout_error then, Operation_error if the send fails.
+   */
+  udp::Task<Node*> send_to_peer(const Endpoint& endpoint, const Buffer& buffer, std::chrono::steady_clock::time_point deadline);
+
+  /**
+   * Gossip buffer to the whole mesh, not only the direct peers. Uses Plumtree: the
+   * message is pushed along a spanning tree of eager links and announced with an
+   * IHAVE on the lazy ones. Duplicates PRUNE the link they came over, a message
+   * announced but not received in time GRAFTs the announcer's link into the tree.
+   * Every hop decrements the TTL, it isn't forwarded once that reaches 0.
+   */
   udp::Task<Node*> broadcast(const Buffer& buffer);
 
   udp::Task<Node*> add_peer(const Endpoint &endpoint);
 
   void subscribe(const std::string& event_type, events::Handler handler);
 
+  /**
+   * Run event handlers on executor's workers instead of the transport's thread.
+   * Call on the thread that drives the node, before start(). The executor must
+   * outlive the node. Handlers may call send_to_peer(), broadcast(), add_peer() and
+   * sleep_async() from the workers, they move to the transport's thread first.
+   */
+  void set_executor(udp::Executor& executor);
+
+  /**
+   * Send the heartbeats every interval instead of HEARTBEAT_INTERVAL. A reply that
+   * takes longer counts as lost. Call before start().
+   */
+  void set_heartbeat_interval(std::chrono::milliseconds interval) noexcept {
+    m_heartbeat_interval = interval;
+  }
+
+  /** Suspend on the transport's timer, the node's other tasks keep running meanwhile. */
   udp::Task<Node*> sleep_async(std::chrono::milliseconds duration);
 
+  /**
+   * The link measurements of the peers as of the last heartbeat round. Thread safe,
+   * reads a snapshot of the peer table and each peer's stats slot.
+   */
+  std::vector<std::pair<Endpoint, Peer_stats>> peer_stats() const;
+
+  /** @return the link measurements of the peer, nullopt if it isn't a peer. */
+  std::optional<Peer_stats> peer_stats(const Endpoint& endpoint) const;
+
+  /** @return the counters of the receive path's duplicate filter. */
+  const Dedup_cache::Stats& dedup_stats() const noexcept {
+    return m_dedup.stats();
+  }
+
+  /**
+   * Start the task if needed and drive the node's transport until it is done.
+   * The node's own loops make progress meanwhile.
+   */
+  template<typename T>
+  void run_until(T& task) {
+    m_transport->run_until(task);
+  }
+
 private:
+  /** @return true if called from an executor's worker, the public entry points then move to the transport's thread. */
+  bool is_off_transport_thread() const noexcept {
+    return m_executor != nullptr && std::this_thread::get_id() != m_transport_thread;
+  }
+
+  /**
+   * Encode the header of a new message from this node.
+   *
+   * @return the header size
+   */
+  size_t make_header(Message_type type, Message_ttl ttl, Header_bytes& header) noexcept;
+
+  /**
+   * Store a gossip message and push it on, eagerly along the tree and as an IHAVE
+   * to the lazy peers.
+   *
+   * @param[in] ttl The TTL the peers receive
+   * @param[in] sender The peer it came from, not sent back there, nullptr if it is ours
+   */
+  udp::Task<Node*> push(std::string_view source_id, Message_id message_id, Message_ttl ttl, std::span<const uint8_t> payload, const sockaddr_in* sender);
+
+  /** A new gossip message arrived from sender, make its link eager and push the message on. */
+  udp::Task<Node*> on_gossip(const Message_view& message, const sockaddr_in& sender);
+
+  /** Handle an IHAVE, GRAFT or PRUNE from sender. */
+  udp::Task<Node*> on_control(const Message_view& message, const sockaddr_in& sender);
+
+  /** Send a header only message about a gossip message. */
+  udp::Task<Node*> send_control(Message_type type, std::string_view source_id, Message_id message_id, const sockaddr_in& addr);
+
+  /** Move the peer at addr in or out of the eager set, ignored if it isn't a peer. */
+  void set_eager(const sockaddr_in& addr, bool is_eager);
+
+  /** Answer a peer's Heartbeat, or take an RTT sample from the reply to ours. */
+  udp::Task<Node*> on_heartbeat(const Message_view& message, const sockaddr_in& sender);
+
+  /**
+   * Send a Heartbeat to every active peer once per heartbeat interval, count the
+   * unanswered ones as lost and publish the peers' stats.
+   */
+  udp::Task<Node*> heartbeat_loop();
+
+  /** GRAFT the messages announced by an IHAVE that didn't arrive in time. */
+  udp::Task<Node*> repair_loop();
+
   /* Listen for incoming messages */
   udp::Task<Node*> receive_loop();
 
   udp::Task<Node*> health_check_loop();
 
+  /** Probe the direct peers with a Discovery message, it isn't gossiped or delivered to the handlers. */
   udp::Task<Node*> discovery_loop();
 
 private:
   Endpoint m_endpoint{};
-  udp::Socket m_socket;
+  std::unique_ptr<udp::Transport> m_transport;
   std::atomic<bool> m_running;
   std::shared_ptr<events::Dispatcher> m_dispatcher;
+  udp::Executor* m_executor{};
+
+  /* The thread that drives the transport, recorded by set_executor() */
+  std::thread::id m_transport_thread{};
+
+  /* The source id of the messages this node sends, its endpoint's peer id */
+  std::string m_source_id{};
+
+  /* Seeded from the clock so that a restarted node doesn't reuse ids */
+  std::atomic<Message_id> m_next_message_id{};
+
+  /* Checked by the receive loop before dispatching */
+  Dedup_cache m_dedup{};
+
+  /* Plumtree state, only touched on the transport's thread, the entry points move there first */
+  Gossip_store m_gossip_store{};
+  std::unordered_map<Message_key, Missing_message, Message_key_hash> m_missing{};
+
+  /* Deadline of every peer, refreshed by each packet from it. Only touched on the transport's thread */
+  Timer_wheel m_liveness{LIVENESS_TICK};
 
-  mutable std::shared_mutex m_peers_mutex;
+  /* Heartbeat state of the peers, only touched on the transport's thread */
+  std::unordered_map<Peer_table::Key, Heartbeat> m_heartbeats{};
+  uint64_t m_heartbeat_round{};
+  std::chrono::milliseconds m_heartbeat_interval{HEARTBEAT_INTERVAL};
 
-  std::unordered_map<std::string, Peer> m_peers;
+  /* Read on every send without a lock, membership changes publish a new table */
+  Rcu<Peer_table> m_peers{};
 
   udp::Task<Node*> m_receive_task;
   udp::Task<Node*> m_health_check_task;
   udp::Task<Node*> m_discovery_task;
+  udp::Task<Node*> m_repair_task;
+  udp::Task<Node*> m_heartbeat_task;
 };
 
 } // namespace mesh
@@ -1,15 +1,26 @@
 #pragma once
 
+#include <arpa/inet.h>
 #include <cstdint>
 #include <string>
 #include <chrono>
 
 #include <libudp/socket.h>
+#include <mesh/peer_stats.h>
 
 namespace mesh {
 
 using Buffer = udp::Buffer;
 
+/** @return the peer id, "address:port", of a datagram's sender. */
+inline std::string to_peer_id(const sockaddr_in& addr) {
+  char address[INET_ADDRSTRLEN]{};
+
+  inet_ntop(AF_INET, &addr.sin_addr, address, sizeof(address));
+
+  return std::string(address) + ":" + std::to_string(ntohs(addr.sin_port));
+}
+
 struct Endpoint {
   Endpoint() = default;
   ~Endpoint() = default;
@@ -18,7 +29,9 @@ struct Endpoint {
    * @brief Construct an endpoint from an address and port
    */
   Endpoint(const std::string& address, uint16_t port)
-    : m_address(address), m_port(port) {}
+    : m_port(port), m_address(address) {
+    m_is_resolved = udp::resolve(m_address, m_port, m_addr);
+  }
 
   std::string to_string() const noexcept {
     return "{ m_address: " + m_address + ", port: " + std::to_string(m_port) + " }";
@@ -32,6 +45,11 @@ struct Endpoint {
     return m_port > 0 && !m_address.empty();
   }
 
+  /** @return true if m_addr holds the binary address, i.e. m_address is a valid IPv4 address. */
+  bool is_resolved() const noexcept {
+    return m_is_resolved;
+  }
+
   std::string to_peer_id() const noexcept {
     return m_address + ":" + std::to_string(m_port);
   }
@@ -59,6 +77,10 @@ struct Endpoint {
 
   uint16_t m_port{};
   std::string m_address{};
+
+  /* Resolved once at construction, sends use it instead of parsing m_address */
+  bool m_is_resolved{};
+  sockaddr_in m_addr{};
 };
 
 struct Peer {
@@ -73,10 +95,16 @@ struct Peer {
 	    ", m_last_seen: " + std::to_string(m_last_seen.time_since_epoch().count());
   }
 
-  /* Round trip time in milliseconds */
   bool m_is_active{};
-  double m_rtt_ms{0.0};
+
+  /* Plumtree: gossip is pushed to eager peers, lazy ones only get IHAVEs */
+  bool m_is_eager{true};
+
+  /* Round trip time, jitter and loss, published once per heartbeat round. Shared by the table's versions */
+  std::shared_ptr<Peer_stats_slot> m_stats{};
   Endpoint m_endpoint{};
+
+  /* When the peer was added, the node's liveness wheel tracks the packets since */
   std::chrono::steady_clock::time_point m_last_seen{};
 };
 
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace mesh {
+
+/**
+ * Link measurements of a peer, from the node's heartbeats. RTT and its variation
+ * are smoothed like TCP's retransmit timer (RFC 6298), the loss rate is a moving
+ * average of the heartbeats that went unanswered.
+ */
+struct Peer_stats {
+  /* Weight of a new RTT sample */
+  static constexpr double RTT_GAIN = 1.0 / 8;
+
+  /* Weight of a new deviation sample */
+  static constexpr double RTT_VAR_GAIN = 1.0 / 4;
+
+  /* Weight of a new heartbeat's outcome */
+  static constexpr double LOSS_GAIN = 1.0 / 16;
+
+  /** Add an RTT sample. */
+  void on_rtt(std::chrono::nanoseconds rtt) noexcept;
+
+  /**
+   * Account for a heartbeat once its outcome is known.
+   *
+   * @param[in] is_answered false if the reply didn't come back before the next heartbeat
+   */
+  void on_probe(bool is_answered) noexcept;
+
+  /* Smoothed round trip time in milliseconds */
+  double m_rtt_ms{};
+
+  /* Mean deviation of the RTT in milliseconds, the jitter */
+  double m_rtt_var_ms{};
+
+  /* Fraction of the recent heartbeats that were lost, 0 to 1 */
+  double m_loss_rate{};
+
+  uint64_t m_n_samples{};
+  uint64_t m_n_probes{};
+  uint64_t m_n_lost{};
+};
+
+/**
+ * Where a peer's stats are published for other threads. Shared by the peer's
+ * entries in the table versions and its heartbeat state, so publishing doesn't
+ * copy the table. Written once per heartbeat round, readers hold the lock only
+ * while copying.
+ */
+struct Peer_stats_slot {
+  void store(const Peer_stats& stats) noexcept;
+
+  Peer_stats load() const noexcept;
+
+  mutable std::mutex m_mutex{};
+  Peer_stats m_stats{};
+};
+
+/** A peer's heartbeat state, kept by the node on the transport's thread. */
+struct Heartbeat {
+  Peer_stats m_stats{};
+
+  /* The peer's slot, m_stats is stored there once per round */
+  std::shared_ptr<Peer_stats_slot> m_published{};
+
+  /* Round of the last heartbeat sent to the peer */
+  uint64_t m_round{};
+
+  /* Sent and not answered yet */
+  bool m_is_outstanding{};
+};
+
+} // namespace mesh
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <netinet/in.h>
+#include <span>
+#include <vector>
+
+#include "mesh/peer.h"
+
+namespace mesh {
+
+/**
+ * The peers of a node in flat arrays. Lookups go through an open-addressing table
+ * (linear probing, backward shift deletion, no tombstones) keyed by the packed
+ * IPv4 address and port, no strings are built or hashed. The peers themselves and
+ * their sockaddr_in are kept densely, index aligned, so that a broadcast is a
+ * linear scan. Erasing moves the last peer into the hole, indices are not stable
+ * across an erase.
+ *
+ * Not thread safe.
+ */
+struct Peer_table {
+  using Key = uint64_t;
+
+  struct Slot {
+    /* 0 if the slot is free, no peer has address 0.0.0.0 and port 0 */
+    Key m_key{};
+
+    /* Index into the dense arrays */
+    uint32_t m_index{};
+  };
+
+  /** @return the key of an address, in network byte order like the address. */
+  static Key key(const sockaddr_in& addr) noexcept {
+    return (Key(addr.sin_addr.s_addr) << 16) | Key(addr.sin_port);
+  }
+
+  /**
+   * @param[in] capacity Peers expected, the table grows beyond it
+   */
+  explicit Peer_table(size_t capacity = 16);
+
+  /** @return the index of the peer, or size() if there is none. */
+  size_t find(Key key) const noexcept;
+
+  Peer* find_peer(Key key) noexcept {
+    const auto index = find(key);
+
+    return index == size() ? nullptr : &m_peers[index];
+  }
+
+  const Peer* find_peer(Key key) const noexcept {
+    const auto index = find(key);
+
+    return index == size() ? nullptr : &m_peers[index];
+  }
+
+  /**
+   * Add a peer, its endpoint must be resolved.
+   *
+   * @return false if there already is a peer with the same address
+   */
+  bool insert(const Peer& peer);
+
+  /**
+   * Remove the peer at index, the last peer takes its place.
+   */
+  void erase_at(size_t index) noexcept;
+
+  bool erase(Key key) noexcept {
+    const auto index = find(key);
+
+    if (index == size()) {
+      return false;
+    }
+
+    erase_at(index);
+
+    return true;
+  }
+
+  size_t size() const noexcept {
+    return m_peers.size();
+  }
+
+  bool empty() const noexcept {
+    return m_peers.empty();
+  }
+
+  /** Dense and index aligned with addrs(). */
+  std::span<Peer> peers() noexcept {
+    return m_peers;
+  }
+
+  std::span<const Peer> peers() const noexcept {
+    return m_peers;
+  }
+
+  /** The peers' addresses, ready to send to. */
+  std::span<const sockaddr_in> addrs() const noexcept {
+    return m_addrs;
+  }
+
+  /** @return the first slot of key's probe sequence. */
+  size_t home(Key key) const noexcept {
+    /* Fibonacci hashing, the low bits of a packed address are the port. */
+    return size_t((key * 0x9e3779b97f4a7c15ULL) >> 32) & m_mask;
+  }
+
+  /** @return the slot holding key, or the free slot where it would go. */
+  size_t probe(Key key) const noexcept {
+    auto i = home(key);
+
+    while (m_slots[i].m_key != 0 && m_slots[i].m_key != key) {
+      i = (i + 1) & m_mask;
+    }
+
+    return i;
+  }
+
+  /** Double the slots, keeps the load factor at or below 1/2. */
+  void grow();
+
+  std::vector<Slot> m_slots{};
+  size_t m_mask{};
+
+  std::vector<Key> m_keys{};
+  std::vector<Peer> m_peers{};
+  std::vector<sockaddr_in> m_addrs{};
+};
+
+} // namespace mesh
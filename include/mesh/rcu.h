@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace mesh {
+
+/**
+ * Epoch based reclamation shared by all the Rcu instances. A reader announces the
+ * global epoch in its thread's slot while it reads, the slots are cache line
+ * padded so readers never write a shared line. A version replaced at epoch e is
+ * freed once no slot announces an epoch at or below e.
+ */
+struct Epoch_domain {
+  /* Threads that may read at the same time */
+  static constexpr size_t MAX_THREADS = 256;
+
+  /* Announced by a thread that isn't reading */
+  static constexpr uint64_t IDLE = UINT64_MAX;
+
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> m_epoch{IDLE};
+    std::atomic<bool> m_is_taken{};
+  };
+
+  static Epoch_domain& instance() noexcept;
+
+  /** Enter a read section, they nest. */
+  void enter();
+
+  void exit() noexcept;
+
+  /**
+   * Start a new epoch.
+   *
+   * @return the epoch that ended, readers that announced it may still see what was replaced
+   */
+  uint64_t advance() noexcept {
+    return m_epoch.fetch_add(1, std::memory_order_seq_cst);
+  }
+
+  /** @return the oldest epoch a reader announced, IDLE if nobody is reading. */
+  uint64_t min_epoch() const noexcept;
+
+  /** @return the calling thread's slot, taken on first use, released when the thread exits. */
+  Slot& this_thread();
+
+  std::atomic<uint64_t> m_epoch{1};
+  std::array<Slot, MAX_THREADS> m_slots{};
+};
+
+/**
+ * A read-mostly value published as immutable versions. Readers get the current
+ * version without a lock or a shared counter, writers copy it, change the copy
+ * and publish that. Replaced versions are freed once the readers that might still
+ * see them are done. Read sections must not span a suspension.
+ */
+template<typename T>
+struct Rcu {
+  /** Keeps the version it read alive until it goes out of scope. */
+  struct Read_guard {
+    explicit Read_guard(const T* value) noexcept : m_value(value) {}
+
+    ~Read_guard() {
+      Epoch_domain::instance().exit();
+    }
+
+    Read_guard(const Read_guard&) = delete;
+    Read_guard& operator=(const Read_guard&) = delete;
+
+    const T* operator->() const noexcept {
+      return m_value;
+    }
+
+    const T& operator*() const noexcept {
+      return *m_value;
+    }
+
+    const T* m_value;
+  };
+
+  explicit Rcu(T value = T{}) : m_current(new T(std::move(value))) {}
+
+  ~Rcu() {
+    delete m_current.load();
+
+    for (auto& [epoch, value] : m_retired) {
+      delete value;
+    }
+  }
+
+  Rcu(const Rcu&) = delete;
+  Rcu& operator=(const Rcu&) = delete;
+
+  /** @return the current version, wait-free once the thread has its slot. */
+  Read_guard read() const {
+    Epoch_domain::instance().enter();
+
+    return Read_guard(m_current.load(std::memory_order_seq_cst));
+  }
+
+  /**
+   * Publish a new version, writers are serialized.
+   *
+   * @param[in] update Changes a copy of the current version, returns false to keep the current one
+   *
+   * @return true if a new version was published
+   */
+  template<typename F>
+  bool update(F&& update) {
+    std::lock_guard lock(m_writer_mutex);
+
+    auto next = std::make_unique<T>(*m_current.load(std::memory_order_relaxed));
+
+    if (!update(*next)) {
+      return false;
+    }
+
+    auto& domain = Epoch_domain::instance();
+    auto previous = m_current.exchange(next.release(), std::memory_order_seq_cst);
+
+    m_retired.emplace_back(domain.advance(), previous);
+
+    reclaim();
+
+    return true;
+  }
+
+  /** Free the replaced versions no reader can see anymore. */
+  void reclaim() noexcept {
+    const auto min_epoch = Epoch_domain::instance().min_epoch();
+
+    std::erase_if(m_retired, [min_epoch](auto& retired) {
+      if (retired.first < min_epoch) {
+        delete retired.second;
+        return true;
+      }
+      return false;
+    });
+  }
+
+  std::atomic<T*> m_current;
+
+  std::mutex m_writer_mutex{};
+
+  /* Replaced versions and the epoch they were replaced in */
+  std::vector<std::pair<uint64_t, T*>> m_retired{};
+};
+
+} // namespace mesh
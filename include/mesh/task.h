@@ -15,28 +15,14 @@ struct Task<mesh::Node*> {
   struct promise_type;
   using handle_type = std::coroutine_handle<promise_type>;
 
-  struct promise_type {
-    std::exception_ptr exception;
-
+  struct promise_type : public Promise_base {
     Task get_return_object() noexcept {
       return Task(std::coroutine_handle<promise_type>::from_promise(*this));
     }
 
-    std::suspend_never initial_suspend() noexcept {
-      return {};
-    }
-
-    std::suspend_always final_suspend() noexcept {
-      return {};
-    }
-
     void return_void() noexcept {}
 
-    void unhandled_exception() noexcept {
-      exception = std::current_exception();
-    }
-
-    mesh::Node* m_node;
+    mesh::Node* m_node{};
   };
 
   Task() noexcept : m_handle(nullptr) {}
@@ -67,11 +53,33 @@ struct Task<mesh::Node*> {
     return *this;
   }
 
-  bool await_ready() const noexcept;
+  void start() {
+    Promise_base::start(m_handle);
+  }
+
+  bool is_done() const noexcept {
+    return m_handle && m_handle.done();
+  }
 
-  bool await_suspend(std::coroutine_handle<> handle);
+  void get_result() {
+    if (m_handle.promise().m_exception) {
+      std::rethrow_exception(m_handle.promise().m_exception);
+    }
+  }
+
+  bool await_ready() const noexcept {
+    return is_done();
+  }
 
-  mesh::Node* await_resume();
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    return Promise_base::await_suspend(m_handle, awaiter);
+  }
+
+  mesh::Node* await_resume() {
+    get_result();
+
+    return m_handle.promise().m_node;
+  }
 
   handle_type m_handle;
 };
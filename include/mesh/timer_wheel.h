@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace mesh {
+
+/**
+ * Hierarchical timing wheel of deadlines keyed by 64-bit ids, the node uses it to
+ * expire peers it hasn't heard from. LEVELS wheels of SLOTS slots, a slot of level
+ * l spans SLOTS^l ticks. Deadlines far away sit in a coarse level and are moved
+ * down a level when the finer wheel wraps, so advancing costs O(1) per tick plus
+ * the timers that fire or cascade.
+ *
+ * Refreshing a deadline that moves later, which is what every received packet
+ * does, only stores it. The timer stays linked where it is, when its slot comes
+ * up it is linked again at the new deadline instead of firing.
+ *
+ * Not thread safe, the node uses it on the transport's thread.
+ */
+struct Timer_wheel {
+  using Clock = std::chrono::steady_clock;
+  using Key = uint64_t;
+
+  static constexpr size_t LEVELS = 4;
+  static constexpr size_t SLOT_BITS = 6;
+  static constexpr size_t SLOTS = size_t{1} << SLOT_BITS;
+
+  /* End of a list */
+  static constexpr uint32_t NIL = UINT32_MAX;
+
+  struct Timer {
+    Key m_key{};
+
+    /* Tick the timer fires at */
+    uint64_t m_deadline{};
+
+    /* Tick of the slot it is linked in, at most m_deadline */
+    uint64_t m_linked{};
+
+    /* Index of the slot in m_slots, NIL if the timer is free */
+    uint32_t m_slot{NIL};
+    uint32_t m_prev{NIL};
+    uint32_t m_next{NIL};
+  };
+
+  /**
+   * @param[in] tick Resolution of the deadlines, a timer fires at most a tick late
+   * @param[in] start Time of tick 0
+   */
+  explicit Timer_wheel(std::chrono::milliseconds tick, Clock::time_point start = Clock::now());
+
+  /** Add a timer for key or move its deadline. */
+  void schedule(Key key, Clock::time_point deadline);
+
+  /**
+   * Move the deadline of key's timer, O(1) and no relinking if it moves later.
+   *
+   * @return false if there is no timer for key
+   */
+  bool touch(Key key, Clock::time_point deadline) noexcept;
+
+  /** @return false if there was no timer for key */
+  bool cancel(Key key) noexcept;
+
+  /**
+   * Advance to now and remove the timers that are due.
+   *
+   * @param[out] expired The keys of the removed timers are appended
+   *
+   * @return the number of timers that expired
+   */
+  size_t advance(Clock::time_point now, std::vector<Key>& expired);
+
+  bool contains(Key key) const noexcept {
+    return m_index.contains(key);
+  }
+
+  size_t size() const noexcept {
+    return m_index.size();
+  }
+
+private:
+  /* Deadlines round up, a timer never fires early. */
+  uint64_t to_tick(Clock::time_point deadline) const noexcept;
+
+  /* Link the timer in the slot of its deadline, relative to m_now. */
+  void link(uint32_t index) noexcept;
+
+  void unlink(uint32_t index) noexcept;
+
+  void release(uint32_t index) noexcept;
+
+  /* Move the timers of the level's current slot down to finer levels. */
+  void cascade(size_t level) noexcept;
+
+  std::chrono::milliseconds m_tick;
+  Clock::time_point m_start;
+
+  /* Ticks processed so far */
+  uint64_t m_now{};
+
+  /* List heads, level by level */
+  std::array<uint32_t, LEVELS * SLOTS> m_slots{};
+
+  std::vector<Timer> m_timers{};
+
+  /* Free timers, linked through m_next */
+  uint32_t m_free{NIL};
+
+  std::unordered_map<Key, uint32_t> m_index{};
+};
+
+} // namespace mesh
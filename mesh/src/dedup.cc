@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <bit>
+#include <functional>
+
+#include "mesh/dedup.h"
+
+namespace mesh {
+
+static_assert(Dedup_cache::WINDOW_SIZE % 64 == 0, "The window is a bitmap of 64-bit words");
+
+/* @return true if the id's bit in the window was already set, sets it */
+static bool test_and_set(Dedup_cache::Source& source, Message_id message_id) noexcept {
+  const auto bit = message_id % Dedup_cache::WINDOW_SIZE;
+  auto& word = source.m_window[bit / 64];
+  const auto mask = uint64_t{1} << (bit % 64);
+  const auto is_set = (word & mask) != 0;
+
+  word |= mask;
+
+  return is_set;
+}
+
+static void clear(Dedup_cache::Source& source, Message_id message_id) noexcept {
+  const auto bit = message_id % Dedup_cache::WINDOW_SIZE;
+
+  source.m_window[bit / 64] &= ~(uint64_t{1} << (bit % 64));
+}
+
+static_assert(MAX_SOURCE_ID_LENGTH <= UINT8_MAX, "The id length is kept in a byte");
+
+static bool is_source(const Dedup_cache::Source& source, uint64_t hash, std::string_view source_id) noexcept {
+  return source.m_hash == hash && source.id() == source_id;
+}
+
+uint64_t Dedup_cache::hash(std::string_view source_id) noexcept {
+  /* 0 marks a free slot. */
+  return std::max<uint64_t>(std::hash<std::string_view>{}(source_id), 1);
+}
+
+Dedup_cache::Dedup_cache(size_t n_sources)
+  : m_sources(std::bit_ceil(std::max(n_sources, MAX_PROBE))),
+    m_mask(m_sources.size() - 1) {}
+
+Dedup_cache::Source& Dedup_cache::find(uint64_t hash, std::string_view source_id) noexcept {
+  Source* victim{};
+
+  for (size_t i = 0; i < MAX_PROBE; ++i) {
+    auto& source = m_sources[(hash + i) & m_mask];
+
+    if (source.m_hash == 0 || is_source(source, hash, source_id)) {
+      return source;
+    } else if (victim == nullptr || source.m_last_seen < victim->m_last_seen) {
+      victim = &source;
+    }
+  }
+
+  ++m_stats.m_n_evictions;
+
+  *victim = Source{};
+
+  return *victim;
+}
+
+bool Dedup_cache::is_duplicate(std::string_view source_id, Message_id message_id) noexcept {
+  if (source_id.size() > MAX_SOURCE_ID_LENGTH) [[unlikely]] {
+    ++m_stats.m_n_hits;
+    return true;
+  }
+
+  const auto hash = Dedup_cache::hash(source_id);
+  auto& source = find(hash, source_id);
+
+  source.m_last_seen = ++m_n_checked;
+
+  if (!is_source(source, hash, source_id)) {
+    source.m_hash = hash;
+    source.m_id_length = uint8_t(source_id.size());
+    std::copy(source_id.begin(), source_id.end(), source.m_id.begin());
+    source.m_highest = message_id;
+    test_and_set(source, message_id);
+
+    ++m_stats.m_n_misses;
+    return false;
+  }
+
+  if (message_id > source.m_highest) {
+    /* Slide the window, the ids it skips over haven't been seen. Every id is
+     * cleared at most once per advance past it, so this is O(1) amortized. */
+    if (message_id - source.m_highest >= WINDOW_SIZE) {
+      source.m_window.fill(0);
+    } else {
+      for (auto id = source.m_highest + 1; id < message_id; ++id) {
+        clear(source, id);
+      }
+      clear(source, message_id);
+    }
+
+    source.m_highest = message_id;
+    test_and_set(source, message_id);
+
+    ++m_stats.m_n_misses;
+    return false;
+  }
+
+  if (source.m_highest - message_id >= WINDOW_SIZE) {
+    ++m_stats.m_n_too_old;
+    ++m_stats.m_n_hits;
+    return true;
+  }
+
+  if (test_and_set(source, message_id)) {
+    ++m_stats.m_n_hits;
+    return true;
+  }
+
+  ++m_stats.m_n_misses;
+  return false;
+}
+
+bool Dedup_cache::contains(std::string_view source_id, Message_id message_id) const noexcept {
+  const auto hash = Dedup_cache::hash(source_id);
+
+  for (size_t i = 0; i < MAX_PROBE; ++i) {
+    const auto& source = m_sources[(hash + i) & m_mask];
+
+    if (is_source(source, hash, source_id)) {
+      if (message_id > source.m_highest || source.m_highest - message_id >= WINDOW_SIZE) {
+        return false;
+      }
+
+      const auto bit = message_id % WINDOW_SIZE;
+
+      return (source.m_window[bit / 64] & (uint64_t{1} << (bit % 64))) != 0;
+    } else if (source.m_hash == 0) {
+      break;
+    }
+  }
+
+  return false;
+}
+
+} // namespace mesh
@@ -1,61 +1,149 @@
+#include <algorithm>
 #include <cstring>
 
 #include <mesh/message.h>
 
 namespace mesh {
 
-Buffer Serialize::operator()(const Message& message) const noexcept {
-    Buffer result{};
-    using Char_type = Buffer::value_type;
+/* Byte at a time, independent of the host's byte order and alignment. */
+template<typename T>
+static uint8_t* store_le(uint8_t* ptr, T value) noexcept {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        *ptr++ = static_cast<uint8_t>(value >> (i * 8));
+    }
+
+    return ptr;
+}
+
+template<typename T>
+static T load_le(const uint8_t* ptr) noexcept {
+    T value{};
+
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value |= static_cast<T>(static_cast<T>(ptr[i]) << (i * 8));
+    }
 
-    /* Reserve space for the header */
-    result.push_back(static_cast<Char_type>(message.m_header.m_type));
+    return value;
+}
+
+size_t encode_header(Message_type type, Message_id message_id, std::string_view source_id, Message_ttl ttl, Header_bytes& out) noexcept {
+    if (source_id.length() > MAX_SOURCE_ID_LENGTH) {
+        return 0;
+    }
+
+    auto ptr = out.data();
+
+    /* Message type */
+    *ptr++ = static_cast<uint8_t>(type);
 
     /* Message ID */
-    auto id_bytes = reinterpret_cast<const Char_type*>(&message.m_header.m_message_id);
-    result.insert(result.end(), id_bytes, id_bytes + sizeof(message.m_header.m_message_id));
+    ptr = store_le(ptr, message_id);
 
     /* Source ID length and data */
-    const auto &peer_id = message.m_header.m_source_id;
-    auto id_length_bytes = static_cast<uint16_t>(peer_id.length());
-    result.insert(result.end(), id_length_bytes, id_length_bytes + sizeof(id_length_bytes));
-    result.insert(result.end(), peer_id.begin(), peer_id.end());
+    ptr = store_le(ptr, static_cast<uint16_t>(source_id.length()));
+    ptr = std::copy(source_id.begin(), source_id.end(), ptr);
 
     /* TTL */
-    auto ttl_bytes = reinterpret_cast<const Char_type*>(&message.m_header.m_ttl);
-    result.insert(result.end(), ttl_bytes, ttl_bytes + sizeof(message.m_header.m_ttl));
+    ptr = store_le(ptr, ttl);
+
+    return size_t(ptr - out.data());
+}
+
+void encode_timestamp(std::chrono::steady_clock::time_point time, Timestamp_bytes& out) noexcept {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+
+    store_le(out.data(), uint64_t(ns));
+}
+
+bool decode_timestamp(std::span<const uint8_t> payload, std::chrono::steady_clock::time_point& time) noexcept {
+    if (payload.size() != sizeof(Timestamp_bytes)) {
+        return false;
+    }
+
+    const auto ns = std::chrono::nanoseconds(int64_t(load_le<uint64_t>(payload.data())));
+
+    time = std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(ns));
+
+    return true;
+}
+
+Buffer Serialize::operator()(const Message& message) const noexcept {
+    const auto& header = message.m_header;
+    Header_bytes header_bytes;
+    const auto header_size = encode_header(header.m_type, header.m_message_id, header.m_source_id, header.m_ttl, header_bytes);
+
+    if (header_size == 0) {
+        log_error("Source id too long: ", header.m_source_id);
+        return Buffer{};
+    }
+
+    Buffer result{};
 
-    /*  Payload */
+    result.reserve(header_size + message.m_payload.size());
+    result.insert(result.end(), header_bytes.begin(), header_bytes.begin() + header_size);
     result.insert(result.end(), message.m_payload.begin(), message.m_payload.end());
 
     return result;
 }
 
-Message Deserialize::operator()(const Buffer& data) const noexcept {
-    Message msg;
-    size_t pos{};
+bool Message_view::parse(std::span<const uint8_t> data) noexcept {
+    *this = Message_view{};
 
-    /* Message type */
-    msg.m_header.m_type = static_cast<Message_type>(data[pos++]);
+    if (data.size() < MIN_SIZE) {
+        return false;
+    }
 
-    /* Message ID */
-    msg.m_header.m_message_id = *reinterpret_cast<const decltype(msg.m_header.m_message_id)*>(&data[pos]);
-    pos += sizeof(decltype(msg.m_header.m_message_id));
+    const auto ptr = data.data();
+    const auto type = ptr[0];
+
+    if (type == uint8_t(Message_type::None) || type > uint8_t(Message_type::Heartbeat_ack)) {
+        return false;
+    }
+
+    const auto id_length = load_le<uint16_t>(ptr + sizeof(Message_type) + sizeof(Message_id));
+
+    /* The only variable length field, once it fits everything else does. */
+    if (data.size() < MIN_SIZE + id_length) {
+        return false;
+    }
+
+    size_t pos{sizeof(Message_type)};
 
-    /* Source ID */
-    auto id_length = *reinterpret_cast<const uint16_t*>(&data[pos]);
-    pos += sizeof(uint16_t);
-    msg.m_header.m_source_id.assign(data.begin() + pos, data.begin() + pos + id_length);
+    m_message_id = load_le<Message_id>(ptr + pos);
+    pos += sizeof(Message_id) + sizeof(uint16_t);
+
+    m_source_id = std::string_view(reinterpret_cast<const char*>(ptr + pos), id_length);
     pos += id_length;
 
-    /* TTL */
-    msg.m_header.m_ttl = *reinterpret_cast<const decltype(msg.m_header.m_ttl)*>(&data[pos]);
-    pos += sizeof(decltype(msg.m_header.m_ttl));
+    m_ttl = load_le<Message_ttl>(ptr + pos);
+    pos += sizeof(Message_ttl);
+
+    m_payload = data.subspan(pos);
+    m_type = static_cast<Message_type>(type);
+
+    return true;
+}
+
+Message Message_view::to_message() const {
+    Message message;
+
+    message.m_header.m_type = m_type;
+    message.m_header.m_message_id = m_message_id;
+    message.m_header.m_source_id.assign(m_source_id);
+    message.m_header.m_ttl = m_ttl;
+    message.m_payload.assign(m_payload.begin(), m_payload.end());
+
+    return message;
+}
+
+Message Deserialize::operator()(const Buffer& data) const noexcept {
+    Message_view view;
 
-    /* Payload */
-    msg.m_payload.assign(data.begin() + pos, data.end());
+    if (!view.parse(data)) {
+        return Message{};
+    }
 
-    return msg;
+    return view.to_message();
 }
 
 } // namespace mesh
@@ -1,14 +1,63 @@
+#include <cstring>
 #include <future>
 
+#include "mesh/error.h"
 #include "mesh/node.h"
 
 namespace mesh {
 
-Node::Node(const Endpoint& endpoint)
+static std::unique_ptr<udp::Transport> make_socket(uint16_t port, const udp::Socket_config& config) {
+  auto socket = std::make_unique<udp::Socket>(port, config);
+
+  /* Large payloads are broadcast to every peer, don't copy them each time. */
+  socket->enable_zero_copy_send();
+
+  return socket;
+}
+
+Node::Node(const Endpoint& endpoint, const udp::Socket_config& config)
+  : Node(endpoint, make_socket(endpoint.m_port, config)) {}
+
+Node::Node(const Endpoint& endpoint, std::unique_ptr<udp::Transport> transport)
   : m_endpoint(endpoint),
-    m_socket(endpoint.m_port),
+    m_transport(std::move(transport)),
+    m_running(),
     m_dispatcher(std::make_shared<events::Dispatcher>()),
-    m_running() { }
+    m_source_id(endpoint.to_peer_id()),
+    m_next_message_id(Message_id(std::chrono::system_clock::now().time_since_epoch().count())) {
+
+  /* Dispatching a Sleep_for suspends the dispatcher on the transport's timer. */
+  m_dispatcher->subscribe("Sleep_for", [this](const std::shared_ptr<events::Event>& event) -> udp::Task<Node*> {
+    co_await sleep_async(std::static_pointer_cast<events::Sleep_for>(event)->m_duration);
+  });
+}
+
+Node::~Node() {
+  m_running = false;
+
+  /* The loops' frames go away with the node, take them off the ring first. */
+  try {
+    /* Handlers still on the executor resume a loop's frame when they are done. */
+    if (m_executor != nullptr) {
+      m_transport->enable_post();
+
+      while (m_dispatcher->m_n_fan_outs > 0) {
+        m_transport->run_once();
+      }
+    }
+
+    m_transport->cancel_all();
+  } catch (const std::exception& e) {
+    log_error("Failed to cancel the node's operations: ", e.what());
+  }
+}
+
+void Node::set_executor(udp::Executor& executor) {
+  m_executor = &executor;
+  m_transport_thread = std::this_thread::get_id();
+  m_transport->enable_post();
+  m_dispatcher->set_executor(m_executor, m_transport.get());
+}
 
 udp::Task<Node*> Node::start() {
   if (m_running) {
@@ -21,6 +70,15 @@ udp::Task<Node*> Node::start() {
   m_receive_task = receive_loop();
   m_health_check_task = health_check_loop();
   m_discovery_task = discovery_loop();
+  m_repair_task = repair_loop();
+  m_heartbeat_task = heartbeat_loop();
+
+  /* They run detached, driven by the transport's completions. */
+  m_receive_task.start();
+  m_health_check_task.start();
+  m_discovery_task.start();
+  m_repair_task.start();
+  m_heartbeat_task.start();
 
   /* Notify network state change */
   auto event = std::make_shared<events::Network_state_changed>();
@@ -40,6 +98,16 @@ udp::Task<Node*> Node::stop() {
 
   m_running = false;
 
+  /* Don't wait for the next packet or timer, the loops resume with -ECANCELED and exit. */
+  const auto n_cancelled = m_transport->cancel_all();
+
+  log_debug("Node stopped, cancelled ", n_cancelled, " operations");
+
+  /* The cancel took the post wakeup off the ring too, handlers still need it. */
+  if (m_executor != nullptr) {
+    m_transport->enable_post();
+  }
+
   /* Notify network state change */
   auto event = std::make_shared<events::Network_state_changed>();
 
@@ -51,62 +119,263 @@ udp::Task<Node*> Node::stop() {
   co_return;
 }
 
+size_t Node::make_header(Message_type type, Message_ttl ttl, Header_bytes& header) noexcept {
+  const auto message_id = m_next_message_id.fetch_add(1, std::memory_order_relaxed);
+
+  return encode_header(type, message_id, m_source_id, ttl, header);
+}
+
 udp::Task<Node*> Node::send_to_peer(const Endpoint &endpoint, const Buffer& buffer) {
-  std::shared_lock lock(m_peers_mutex);
+  /* Called from a handler on the executor, the node's state belongs to the transport's thread. */
+  if (is_off_transport_thread()) {
+    co_await m_transport->schedule();
+  }
 
-  if (auto it = m_peers.find(endpoint.to_peer_id()); it != m_peers.end() && it->second.m_is_active) {
+  if (!endpoint.is_resolved()) {
+    log_error("Invalid peer address: ", endpoint.to_peer_id());
+    co_return;
+  }
 
-    const auto port{it->second.m_endpoint.m_port};
-    const auto &address{it->second.m_endpoint.m_address};
+  const auto& addr = endpoint.m_addr;
 
-    auto task = m_socket.send_async(address, port, buffer.data(), buffer.size());
+  {
+    const auto peers = m_peers.read();
+    const auto peer = peers->find_peer(Peer_table::key(addr));
 
-    if (!task.is_done()) {
-      // FIXME: Schedule another task to resum. This makes it synchronous.
-      task.resume();
+    if (peer == nullptr || !peer->m_is_active) {
+      co_return;
     }
+  }
 
-    co_return;
+  Header_bytes header;
+  const std::array<iovec, 2> iov{{
+    {header.data(), make_header(Message_type::Data, 0, header)},
+    {const_cast<uint8_t*>(buffer.data()), buffer.size()}
+  }};
+
+  /* The snapshot is not held across the suspension, the peer may go away meanwhile. */
+  if (const auto ret = co_await m_transport->send_async(addr, iov); ret < 0) {
+    log_error("Send to ", endpoint.to_peer_id(), " failed: ", strerror(-ret));
+  }
+
+  co_return;
+}
+
+udp::Task<Node*> Node::send_to_peer(const Endpoint &endpoint, const Buffer& buffer, std::chrono::steady_clock::time_point deadline) {
+  /* Called from a handler on the executor, the node's state belongs to the transport's thread. */
+  if (is_off_transport_thread()) {
+    co_await m_transport->schedule();
+  }
+
+  if (!endpoint.is_resolved()) {
+    throw Operation_error("Invalid peer address: " + endpoint.to_peer_id());
+  }
+
+  const auto& addr = endpoint.m_addr;
+
+  {
+    const auto peers = m_peers.read();
+    const auto peer = peers->find_peer(Peer_table::key(addr));
+
+    if (peer == nullptr || !peer->m_is_active) {
+      throw Operation_error("Not an active peer: " + endpoint.to_peer_id());
+    }
+  }
+
+  Header_bytes header;
+  const std::array<iovec, 2> iov{{
+    {header.data(), make_header(Message_type::Data, 0, header)},
+    {const_cast<uint8_t*>(buffer.data()), buffer.size()}
+  }};
+
+  const auto ret = co_await m_transport->send_async(addr, iov, deadline);
+
+  if (ret == -ETIMEDOUT) {
+    throw Timeout_error("Send to " + endpoint.to_peer_id() + " timed out");
+  } else if (ret < 0) {
+    throw Operation_error("Send to " + endpoint.to_peer_id() + " failed: " + strerror(-ret));
   }
 
   co_return;
 }
 
 udp::Task<Node*> Node::broadcast(const Buffer& buffer) {
-  std::shared_lock lock(m_peers_mutex);
+  /* Called from a handler on the executor, the node's state belongs to the transport's thread. */
+  if (is_off_transport_thread()) {
+    co_await m_transport->schedule();
+  }
+
+  const auto message_id = m_next_message_id.fetch_add(1, std::memory_order_relaxed);
+
+  /* Our own message coming back over another link is a duplicate, and prunes it. */
+  m_dedup.is_duplicate(m_source_id, message_id);
+
+  co_await push(m_source_id, message_id, DEFAULT_TTL, buffer, nullptr);
+
+  co_return;
+}
+
+udp::Task<Node*> Node::push(std::string_view source_id, Message_id message_id, Message_ttl ttl, std::span<const uint8_t> payload, const sockaddr_in* sender) {
+  /* One header and payload, gathered by the kernel for every eager peer. */
+  Header_bytes header;
+  const auto header_size = encode_header(Message_type::Data, message_id, source_id, ttl, header);
 
-  for (const auto& [peer_id, peer] : m_peers) {
-    if (peer.m_is_active) {
+  const std::array<iovec, 2> iov{{
+    {header.data(), header_size},
+    {const_cast<uint8_t*>(payload.data()), payload.size()}
+  }};
 
-      const auto port{peer.m_endpoint.m_port};
-      const auto address{peer.m_endpoint.m_address};
+  Header_bytes ihave;
+  const std::array<iovec, 1> ihave_iov{{
+    {ihave.data(), encode_header(Message_type::Ihave, message_id, source_id, 0, ihave)}
+  }};
 
-      auto task = m_socket.send_async(address, port, buffer.data(), buffer.size());
+  m_gossip_store.insert(Message_key{std::string(source_id), message_id}, std::span(header.data(), header_size), payload);
 
-      if (!task.is_done()) {
-        // FIXME: Schedule another task to resum. This makes it synchronous.
-        task.resume();
+  std::vector<udp::Outgoing_datagram> datagrams{};
+
+  {
+    const auto table = m_peers.read();
+    const auto peers = table->peers();
+    const auto addrs = table->addrs();
+    const auto sender_key = sender == nullptr ? Peer_table::Key{} : Peer_table::key(*sender);
+
+    datagrams.reserve(peers.size());
+
+    /* A linear scan over the dense arrays, every peer in the table is resolved. */
+    for (size_t i = 0; i < peers.size(); ++i) {
+      if (!peers[i].m_is_active || Peer_table::key(addrs[i]) == sender_key) {
+        continue;
       }
+
+      udp::Outgoing_datagram datagram{};
+
+      datagram.m_addr = addrs[i];
+      datagram.m_iov = peers[i].m_is_eager ? std::span<const iovec>(iov) : std::span<const iovec>(ihave_iov);
+
+      datagrams.push_back(datagram);
     }
   }
+
+  /* One submission for all the peers. */
+  if (!datagrams.empty()) {
+    co_await m_transport->send_batch(datagrams);
+  }
+
   co_return;
 }
 
-udp::Task<Node*> Node::add_peer(const Endpoint &endpoint) {
-    std::unique_lock lock(m_peers_mutex);
-    std::string peer_id{endpoint.to_peer_id()};
+udp::Task<Node*> Node::on_gossip(const Message_view& message, const sockaddr_in& sender) {
+  if (!m_missing.empty()) {
+    m_missing.erase(Message_key{std::string(message.m_source_id), message.m_message_id});
+  }
 
-    if (m_peers.contains(peer_id)) {
-      co_return;
+  /* It came over this link first, the link belongs in the tree. */
+  set_eager(sender, true);
+
+  if (message.m_ttl > 0) {
+    co_await push(message.m_source_id, message.m_message_id, Message_ttl(message.m_ttl - 1), message.m_payload, &sender);
+  }
+
+  co_return;
+}
+
+udp::Task<Node*> Node::on_control(const Message_view& message, const sockaddr_in& sender) {
+  switch (message.m_type) {
+    case Message_type::Ihave:
+      if (!m_dedup.contains(message.m_source_id, message.m_message_id)) {
+        /* Give the eager path a chance first, only the first announcer is remembered. */
+        m_missing.try_emplace(Message_key{std::string(message.m_source_id), message.m_message_id},
+                              Missing_message{sender, std::chrono::steady_clock::now() + GRAFT_TIMEOUT});
+      }
+      break;
+
+    case Message_type::Graft:
+      set_eager(sender, true);
+
+      if (const auto datagram = m_gossip_store.find(Message_key{std::string(message.m_source_id), message.m_message_id}); datagram != nullptr) {
+        /* A copy, the store may drop the message while the send is in flight. */
+        const Buffer copy{*datagram};
+
+        if (const auto ret = co_await m_transport->send_async(sender, copy.data(), int(copy.size())); ret < 0) {
+          log_error("Send of grafted message failed: ", strerror(-ret));
+        }
+      }
+      break;
+
+    case Message_type::Prune:
+      set_eager(sender, false);
+      break;
+
+    default:
+      break;
+  }
+
+  co_return;
+}
+
+udp::Task<Node*> Node::send_control(Message_type type, std::string_view source_id, Message_id message_id, const sockaddr_in& addr) {
+  Header_bytes header;
+  const auto header_size = encode_header(type, message_id, source_id, 0, header);
+
+  if (const auto ret = co_await m_transport->send_async(addr, header.data(), int(header_size)); ret < 0) {
+    log_error("Send of ", to_string(type), " failed: ", strerror(-ret));
+  }
+
+  co_return;
+}
+
+void Node::set_eager(const sockaddr_in& addr, bool is_eager) {
+  const auto key = Peer_table::key(addr);
+
+  {
+    const auto peers = m_peers.read();
+    const auto peer = peers->find_peer(key);
+
+    /* Most calls don't change anything, don't copy the table for them. */
+    if (peer == nullptr || peer->m_is_eager == is_eager) {
+      return;
+    }
+  }
+
+  m_peers.update([key, is_eager](Peer_table& peers) {
+    auto peer = peers.find_peer(key);
+
+    if (peer == nullptr) {
+      return false;
     }
 
-    Peer peer;
+    peer->m_is_eager = is_eager;
 
-    peer.m_is_active = true;
-    peer.m_endpoint = endpoint;
-    peer.m_last_seen = std::chrono::steady_clock::now();
+    return true;
+  });
+}
+
+udp::Task<Node*> Node::add_peer(const Endpoint &endpoint) {
+    /* Called from a handler on the executor, the node's state belongs to the transport's thread. */
+    if (is_off_transport_thread()) {
+      co_await m_transport->schedule();
+    }
+
+    {
+      if (!endpoint.is_resolved()) {
+        log_error("Invalid peer address: ", endpoint.to_peer_id());
+        co_return;
+      }
+
+      Peer peer;
 
-    m_peers[peer_id] = peer;
+      peer.m_is_active = true;
+      peer.m_endpoint = endpoint;
+      peer.m_last_seen = std::chrono::steady_clock::now();
+      peer.m_stats = std::make_shared<Peer_stats_slot>();
+
+      if (!m_peers.update([&peer](Peer_table& peers) { return peers.insert(peer); })) {
+        co_return;
+      }
+
+      m_liveness.schedule(Peer_table::key(endpoint.m_addr), peer.m_last_seen + PEER_TIMEOUT);
+    }
 
     auto event = std::make_shared<events::Peer_connected>();
 
@@ -123,22 +392,79 @@ void Node::subscribe(const std::string& event_type, events::Handler handler) {
 
 udp::Task<Node*> Node::receive_loop() {
   /* Max size of a UDP packet */
-  Buffer buffer(65536);
+  auto buffer = std::make_shared<Buffer>(65536);
 
-  std::string error_message{};
+  /* Reused with the buffer while no handler holds on to them, receiving doesn't allocate then. */
+  auto event = std::make_shared<events::Message_received>();
 
   while (m_running) {
+    std::string error_message{};
+
     try {
-      auto task = m_socket.receive_async(buffer);
+      /* A handler kept the event or its bytes, leave the buffer to it. */
+      if (event.use_count() > 1 || buffer.use_count() > 2) {
+        event = std::make_shared<events::Message_received>();
+        buffer = std::make_shared<Buffer>(65536);
+      }
+
+      sockaddr_in from{};
+      const auto ret = co_await m_transport->receive_async(*buffer, from);
 
-      if (!task.is_done()) {
-        // FIXME: Schedule another task to resum. This makes it synchronous.
-        task.resume();
+      if (ret == -ECANCELED && !m_running) {
+        break;
+      } else if (ret < 0) {
+        throw std::runtime_error(strerror(-ret));
       }
 
-      /* Create message received event */
-      auto event = std::make_shared<events::Message_received>();
-      event->m_data = buffer;
+      /* O(1), strangers have no timer and are ignored. */
+      m_liveness.touch(Peer_table::key(from), std::chrono::steady_clock::now() + PEER_TIMEOUT);
+
+      const std::span<const uint8_t> datagram(buffer->data(), size_t(ret));
+      Message_view message;
+
+      if (message.parse(datagram)) {
+        if (message.m_type == Message_type::Ihave || message.m_type == Message_type::Graft || message.m_type == Message_type::Prune) {
+          co_await on_control(message, from);
+          continue;
+        }
+
+        /* A probe from a direct peer, it only refreshed the sender's liveness above. */
+        if (message.m_type == Message_type::Discovery) {
+          continue;
+        }
+
+        /* Heartbeat ids are rounds, not message ids, they bypass the duplicate filter. */
+        if (message.m_type == Message_type::Heartbeat || message.m_type == Message_type::Heartbeat_ack) {
+          co_await on_heartbeat(message, from);
+          continue;
+        }
+
+        /* Floods and retransmits end here, before an event or the dispatcher is touched. */
+        if (m_dedup.is_duplicate(message.m_source_id, message.m_message_id)) {
+          /* The sender is a redundant path to us, take its link out of the tree. */
+          if (message.m_type == Message_type::Data) {
+            set_eager(from, false);
+            co_await send_control(Message_type::Prune, m_source_id, 0, from);
+          }
+          continue;
+        }
+
+        /* Forwarded before the handlers run, the next hops don't wait for them. */
+        if (message.m_type == Message_type::Data) {
+          co_await on_gossip(message, from);
+        }
+      }
+
+      /* Parsed in place, the event keeps the buffer it points into. */
+      event->m_data = datagram;
+      event->m_buffer = buffer;
+      event->m_message = message;
+
+      if (message.is_valid()) {
+        event->m_from_peer.assign(message.m_source_id);
+      } else {
+        event->m_from_peer.clear();
+      }
 
       co_await m_dispatcher->dispatch(event);
 
@@ -147,12 +473,12 @@ udp::Task<Node*> Node::receive_loop() {
     }
 
     if (!error_message.empty()) {
-      auto event = std::make_shared<events::Network_state_changed>();
+      auto state_event = std::make_shared<events::Network_state_changed>();
 
-      event->m_is_healthy = false;
-      event->m_status = error_message;
+      state_event->m_is_healthy = false;
+      state_event->m_status = error_message;
 
-      co_await m_dispatcher->dispatch(event);
+      co_await m_dispatcher->dispatch(state_event);
     }
   }
 }
@@ -162,26 +488,42 @@ udp::Task<Node*> Node::health_check_loop() {
 
   while (m_running) {
     try {
-      std::unique_lock lock(m_peers_mutex);
-      auto now = std::chrono::steady_clock::now();
+      std::vector<Peer_table::Key> expired{};
+      std::vector<std::string> disconnected{};
 
-      for (auto it = m_peers.begin(); it != m_peers.end();) {
-        if (now - it->second.m_last_seen > std::chrono::seconds(30)) {
-          if (it->second.m_is_active) {
-            it->second.m_is_active = false;
+      /* Only the peers that expired are looked at, nothing is published if there are none. */
+      if (m_liveness.advance(std::chrono::steady_clock::now(), expired) > 0) {
+        m_peers.update([&](Peer_table& peers) {
+          for (const auto key : expired) {
+            const auto index = peers.find(key);
 
-            // Notify peer disconnected
-            auto event = std::make_shared<events::Peer_disconnected>();
+            if (index == peers.size()) {
+              continue;
+            }
 
-            event->m_peer_id = it->first;
+            if (peers.peers()[index].m_is_active) {
+              disconnected.push_back(peers.peers()[index].m_endpoint.to_peer_id());
+            }
 
-            co_await m_dispatcher->dispatch(event);
+            peers.erase_at(index);
           }
-          it = m_peers.erase(it);
-        } else {
-          ++it;
+
+          return true;
+        });
+
+        for (const auto key : expired) {
+          m_heartbeats.erase(key);
         }
       }
+
+      /* Published before notifying, sends no longer see these peers. */
+      for (auto& peer_id : disconnected) {
+        auto event = std::make_shared<events::Peer_disconnected>();
+
+        event->m_peer_id = std::move(peer_id);
+
+        co_await m_dispatcher->dispatch(event);
+      }
     } catch (const std::exception& e) {
       error_message = std::string("Health check error: ") + e.what();
     }
@@ -195,23 +537,47 @@ udp::Task<Node*> Node::health_check_loop() {
       co_await m_dispatcher->dispatch(event);
     }
 
-    auto event = std::make_shared<events::Sleep_for>();
-
-    event->m_duration = std::chrono::seconds(5);
-
-    co_await m_dispatcher->dispatch(event);
+    co_await sleep_async(HEALTH_CHECK_INTERVAL);
   }
 }
 
 udp::Task<Node*> Node::discovery_loop() {
+  std::vector<udp::Outgoing_datagram> datagrams{};
+
   while (m_running) {
     std::string error_message{};
 
     try {
+      /* Header only, to the direct peers. Not gossip, it would flood the mesh. */
+      Header_bytes header;
+      const std::array<iovec, 1> iov{{
+        {header.data(), make_header(Message_type::Discovery, 0, header)}
+      }};
+
+      datagrams.clear();
+
+      {
+        const auto table = m_peers.read();
+        const auto peers = table->peers();
+        const auto addrs = table->addrs();
+
+        for (size_t i = 0; i < peers.size(); ++i) {
+          if (!peers[i].m_is_active) {
+            continue;
+          }
 
-      Buffer msg = {'D', 'I', 'S', 'C'};
+          udp::Outgoing_datagram datagram{};
+
+          datagram.m_addr = addrs[i];
+          datagram.m_iov = iov;
+
+          datagrams.push_back(datagram);
+        }
+      }
 
-      co_await broadcast(msg);
+      if (!datagrams.empty()) {
+        co_await m_transport->send_batch(datagrams);
+      }
 
     } catch (const std::exception& e) {
       error_message = std::string("Discovery error: ") + e.what();
@@ -226,20 +592,178 @@ udp::Task<Node*> Node::discovery_loop() {
       co_await m_dispatcher->dispatch(event);
     }
 
-    auto event = std::make_shared<events::Sleep_for>();
+    co_await sleep_async(std::chrono::seconds(30));
+  }
+}
 
-    event->m_duration = std::chrono::seconds(30);
+udp::Task<Node*> Node::repair_loop() {
+  std::vector<std::pair<Message_key, sockaddr_in>> grafts{};
 
-    co_await m_dispatcher->dispatch(event);
+  while (m_running) {
+    const auto now = std::chrono::steady_clock::now();
+
+    for (auto it = m_missing.begin(); it != m_missing.end();) {
+      if (it->second.m_deadline <= now) {
+        if (!m_dedup.contains(it->first.m_source_id, it->first.m_message_id)) {
+          grafts.emplace_back(it->first, it->second.m_announcer);
+        }
+        it = m_missing.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    /* The eager path lost the message, pull it over the announcer's link and keep
+     * that link in the tree. Sent after the scan, the map changes across suspensions. */
+    for (const auto& [key, announcer] : grafts) {
+      set_eager(announcer, true);
+      co_await send_control(Message_type::Graft, key.m_source_id, key.m_message_id, announcer);
+    }
+
+    grafts.clear();
+
+    co_await sleep_async(REPAIR_INTERVAL);
   }
 }
 
-udp::Task<Node*> Node::sleep_async(std::chrono::milliseconds duration) {
-  auto event = std::make_shared<events::Sleep_for>();
+udp::Task<Node*> Node::on_heartbeat(const Message_view& message, const sockaddr_in& sender) {
+  const auto key = Peer_table::key(sender);
 
-  event->m_duration = duration;
+  if (message.m_type == Message_type::Heartbeat) {
+    /* Only peers get an answer, the node doesn't echo for strangers. */
+    if (m_peers.read()->find_peer(key) == nullptr) {
+      co_return;
+    }
 
-  co_await m_dispatcher->dispatch(event);
+    Header_bytes header;
+    const std::array<iovec, 2> iov{{
+      {header.data(), encode_header(Message_type::Heartbeat_ack, message.m_message_id, m_source_id, 0, header)},
+      {const_cast<uint8_t*>(message.m_payload.data()), message.m_payload.size()}
+    }};
+
+    if (const auto ret = co_await m_transport->send_async(sender, iov); ret < 0) {
+      log_error("Send of Heartbeat_ack failed: ", strerror(-ret));
+    }
+
+    co_return;
+  }
+
+  auto it = m_heartbeats.find(key);
+  std::chrono::steady_clock::time_point sent_at{};
+
+  /* Replies to an earlier round came too late, that round was already counted as lost. */
+  if (it == m_heartbeats.end() || !it->second.m_is_outstanding || it->second.m_round != message.m_message_id || !decode_timestamp(message.m_payload, sent_at)) {
+    co_return;
+  }
+
+  auto& heartbeat = it->second;
+
+  heartbeat.m_is_outstanding = false;
+  heartbeat.m_stats.on_rtt(std::chrono::steady_clock::now() - sent_at);
+  heartbeat.m_stats.on_probe(true);
+
+  co_return;
+}
+
+udp::Task<Node*> Node::heartbeat_loop() {
+  std::vector<udp::Outgoing_datagram> datagrams{};
+
+  while (m_running) {
+    const auto round = ++m_heartbeat_round;
+
+    /* One header and timestamp for all the peers, the round is the message id. */
+    Header_bytes header;
+    Timestamp_bytes timestamp;
+
+    encode_timestamp(std::chrono::steady_clock::now(), timestamp);
+
+    const std::array<iovec, 2> iov{{
+      {header.data(), encode_header(Message_type::Heartbeat, round, m_source_id, 0, header)},
+      {timestamp.data(), timestamp.size()}
+    }};
+
+    datagrams.clear();
+
+    {
+      const auto table = m_peers.read();
+      const auto peers = table->peers();
+      const auto addrs = table->addrs();
+
+      for (size_t i = 0; i < peers.size(); ++i) {
+        if (!peers[i].m_is_active) {
+          continue;
+        }
+
+        auto& heartbeat = m_heartbeats[Peer_table::key(addrs[i])];
+
+        if (heartbeat.m_published == nullptr) {
+          heartbeat.m_published = peers[i].m_stats;
+        }
+
+        /* The previous round's reply didn't make it back within the interval. */
+        if (heartbeat.m_is_outstanding) {
+          heartbeat.m_stats.on_probe(false);
+        }
+
+        heartbeat.m_round = round;
+        heartbeat.m_is_outstanding = true;
+
+        udp::Outgoing_datagram datagram{};
+
+        datagram.m_addr = addrs[i];
+        datagram.m_iov = iov;
+
+        datagrams.push_back(datagram);
+      }
+    }
+
+    /* Published once per round into the peers' slots, the table isn't copied. */
+    for (const auto& [key, heartbeat] : m_heartbeats) {
+      if (heartbeat.m_published != nullptr) {
+        heartbeat.m_published->store(heartbeat.m_stats);
+      }
+    }
+
+    if (!datagrams.empty()) {
+      co_await m_transport->send_batch(datagrams);
+    }
+
+    co_await sleep_async(m_heartbeat_interval);
+  }
+}
+
+std::vector<std::pair<Endpoint, Peer_stats>> Node::peer_stats() const {
+  const auto table = m_peers.read();
+  std::vector<std::pair<Endpoint, Peer_stats>> stats{};
+
+  stats.reserve(table->size());
+
+  for (const auto& peer : table->peers()) {
+    stats.emplace_back(peer.m_endpoint, peer.m_stats != nullptr ? peer.m_stats->load() : Peer_stats{});
+  }
+
+  return stats;
+}
+
+std::optional<Peer_stats> Node::peer_stats(const Endpoint& endpoint) const {
+  const auto table = m_peers.read();
+
+  if (const auto peer = table->find_peer(Peer_table::key(endpoint.m_addr)); peer != nullptr) {
+    return peer->m_stats != nullptr ? peer->m_stats->load() : Peer_stats{};
+  }
+
+  return std::nullopt;
+}
+
+udp::Task<Node*> Node::sleep_async(std::chrono::milliseconds duration) {
+  /* Called from a handler on the executor, the node's state belongs to the transport's thread. */
+  if (is_off_transport_thread()) {
+    co_await m_transport->schedule();
+  }
+
+  if (const auto ret = co_await m_transport->sleep_async(duration); ret < 0 && ret != -ECANCELED) {
+    log_error("Sleep failed: ", strerror(-ret));
+  }
 }
 
 } // namespace mesh
@@ -0,0 +1,43 @@
+#include <cmath>
+
+#include "mesh/peer_stats.h"
+
+namespace mesh {
+
+void Peer_stats::on_rtt(std::chrono::nanoseconds rtt) noexcept {
+  const auto sample_ms = std::chrono::duration<double, std::milli>(rtt).count();
+
+  if (m_n_samples++ == 0) {
+    /* The first sample, RFC 6298 section 2.2. */
+    m_rtt_ms = sample_ms;
+    m_rtt_var_ms = sample_ms / 2;
+  } else {
+    /* The deviation uses the RTT from before this sample. */
+    m_rtt_var_ms += RTT_VAR_GAIN * (std::abs(m_rtt_ms - sample_ms) - m_rtt_var_ms);
+    m_rtt_ms += RTT_GAIN * (sample_ms - m_rtt_ms);
+  }
+}
+
+void Peer_stats::on_probe(bool is_answered) noexcept {
+  ++m_n_probes;
+
+  if (!is_answered) {
+    ++m_n_lost;
+  }
+
+  m_loss_rate += LOSS_GAIN * ((is_answered ? 0.0 : 1.0) - m_loss_rate);
+}
+
+void Peer_stats_slot::store(const Peer_stats& stats) noexcept {
+  std::lock_guard lock(m_mutex);
+
+  m_stats = stats;
+}
+
+Peer_stats Peer_stats_slot::load() const noexcept {
+  std::lock_guard lock(m_mutex);
+
+  return m_stats;
+}
+
+} // namespace mesh
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <bit>
+
+#include "mesh/peer_table.h"
+
+namespace mesh {
+
+Peer_table::Peer_table(size_t capacity)
+  : m_slots(std::bit_ceil(std::max<size_t>(capacity * 2, 8))),
+    m_mask(m_slots.size() - 1) {
+
+  m_keys.reserve(capacity);
+  m_peers.reserve(capacity);
+  m_addrs.reserve(capacity);
+}
+
+size_t Peer_table::find(Key key) const noexcept {
+  const auto& slot = m_slots[probe(key)];
+
+  return slot.m_key == key ? slot.m_index : size();
+}
+
+bool Peer_table::insert(const Peer& peer) {
+  assert(peer.m_endpoint.is_resolved());
+
+  const auto key = Peer_table::key(peer.m_endpoint.m_addr);
+
+  if (m_slots[probe(key)].m_key == key) {
+    return false;
+  }
+
+  if ((size() + 1) * 2 > m_slots.size()) {
+    grow();
+  }
+
+  auto& slot = m_slots[probe(key)];
+
+  slot.m_key = key;
+  slot.m_index = uint32_t(size());
+
+  m_keys.push_back(key);
+  m_peers.push_back(peer);
+  m_addrs.push_back(peer.m_endpoint.m_addr);
+
+  return true;
+}
+
+void Peer_table::erase_at(size_t index) noexcept {
+  assert(index < size());
+
+  auto hole = probe(m_keys[index]);
+
+  /* Backward shift: pull later entries of the probe sequence into the hole, until
+   * a free slot or an entry that is already at or after its home slot. */
+  for (auto i = (hole + 1) & m_mask; m_slots[i].m_key != 0; i = (i + 1) & m_mask) {
+    const auto home = Peer_table::home(m_slots[i].m_key);
+
+    /* The entry may move back if its home isn't between the hole and it, cyclically. */
+    if (((i - home) & m_mask) >= ((i - hole) & m_mask)) {
+      m_slots[hole] = m_slots[i];
+      hole = i;
+    }
+  }
+
+  m_slots[hole] = Slot{};
+
+  /* Keep the dense arrays dense, the last peer moves into index. */
+  const auto last = size() - 1;
+
+  if (index != last) {
+    m_keys[index] = m_keys[last];
+    m_peers[index] = std::move(m_peers[last]);
+    m_addrs[index] = m_addrs[last];
+
+    m_slots[probe(m_keys[index])].m_index = uint32_t(index);
+  }
+
+  m_keys.pop_back();
+  m_peers.pop_back();
+  m_addrs.pop_back();
+}
+
+void Peer_table::grow() {
+  m_slots.assign(m_slots.size() * 2, Slot{});
+  m_mask = m_slots.size() - 1;
+
+  for (size_t i = 0; i < m_keys.size(); ++i) {
+    auto& slot = m_slots[probe(m_keys[i])];
+
+    slot.m_key = m_keys[i];
+    slot.m_index = uint32_t(i);
+  }
+}
+
+} // namespace mesh
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "mesh/rcu.h"
+
+namespace mesh {
+
+/* Gives the slot back when the thread exits. */
+struct Slot_registration {
+  ~Slot_registration() {
+    if (m_slot != nullptr) {
+      m_slot->m_epoch.store(Epoch_domain::IDLE, std::memory_order_release);
+      m_slot->m_is_taken.store(false, std::memory_order_release);
+    }
+  }
+
+  Epoch_domain::Slot* m_slot{};
+
+  /* Nesting depth of the thread's read sections */
+  size_t m_depth{};
+};
+
+static thread_local Slot_registration t_registration{};
+
+Epoch_domain& Epoch_domain::instance() noexcept {
+  static Epoch_domain domain;
+
+  return domain;
+}
+
+Epoch_domain::Slot& Epoch_domain::this_thread() {
+  if (t_registration.m_slot != nullptr) [[likely]] {
+    return *t_registration.m_slot;
+  }
+
+  for (auto& slot : m_slots) {
+    if (!slot.m_is_taken.load(std::memory_order_relaxed) && !slot.m_is_taken.exchange(true, std::memory_order_acquire)) {
+      t_registration.m_slot = &slot;
+      return slot;
+    }
+  }
+
+  throw std::runtime_error("More than " + std::to_string(MAX_THREADS) + " threads reading at once");
+}
+
+void Epoch_domain::enter() {
+  auto& slot = this_thread();
+
+  if (t_registration.m_depth++ == 0) {
+    /* seq_cst orders the announcement before the reader loads the version. */
+    slot.m_epoch.store(m_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+  }
+}
+
+void Epoch_domain::exit() noexcept {
+  if (--t_registration.m_depth == 0) {
+    t_registration.m_slot->m_epoch.store(IDLE, std::memory_order_release);
+  }
+}
+
+uint64_t Epoch_domain::min_epoch() const noexcept {
+  auto min_epoch = IDLE;
+
+  for (const auto& slot : m_slots) {
+    min_epoch = std::min(min_epoch, slot.m_epoch.load(std::memory_order_seq_cst));
+  }
+
+  return min_epoch;
+}
+
+} // namespace mesh
@@ -0,0 +1,192 @@
+#include <algorithm>
+
+#include "mesh/timer_wheel.h"
+
+namespace mesh {
+
+/* Ticks covered by the levels below level, and by a slot of level. */
+static constexpr uint64_t span(size_t level) noexcept {
+  return uint64_t{1} << (Timer_wheel::SLOT_BITS * level);
+}
+
+Timer_wheel::Timer_wheel(std::chrono::milliseconds tick, Clock::time_point start)
+  : m_tick(std::max(tick, std::chrono::milliseconds(1))),
+    m_start(start) {
+  m_slots.fill(NIL);
+}
+
+uint64_t Timer_wheel::to_tick(Clock::time_point deadline) const noexcept {
+  if (deadline <= m_start) {
+    return 0;
+  }
+
+  const auto elapsed = deadline - m_start;
+
+  return uint64_t((elapsed + m_tick - Clock::duration(1)) / m_tick);
+}
+
+void Timer_wheel::link(uint32_t index) noexcept {
+  auto& timer = m_timers[index];
+  auto when = std::max(timer.m_deadline, m_now);
+
+  /* Beyond the top level it comes around again and is linked further on then. */
+  when = std::min(when, m_now + span(LEVELS) - 1);
+
+  size_t level = 0;
+
+  while (when - m_now >= span(level + 1)) {
+    ++level;
+  }
+
+  const auto slot = uint32_t(level * SLOTS + ((when >> (SLOT_BITS * level)) & (SLOTS - 1)));
+
+  timer.m_linked = when;
+  timer.m_slot = slot;
+  timer.m_prev = NIL;
+  timer.m_next = m_slots[slot];
+
+  if (timer.m_next != NIL) {
+    m_timers[timer.m_next].m_prev = index;
+  }
+
+  m_slots[slot] = index;
+}
+
+void Timer_wheel::unlink(uint32_t index) noexcept {
+  auto& timer = m_timers[index];
+
+  if (timer.m_prev != NIL) {
+    m_timers[timer.m_prev].m_next = timer.m_next;
+  } else {
+    m_slots[timer.m_slot] = timer.m_next;
+  }
+
+  if (timer.m_next != NIL) {
+    m_timers[timer.m_next].m_prev = timer.m_prev;
+  }
+}
+
+void Timer_wheel::release(uint32_t index) noexcept {
+  auto& timer = m_timers[index];
+
+  m_index.erase(timer.m_key);
+
+  timer.m_slot = NIL;
+  timer.m_next = m_free;
+  m_free = index;
+}
+
+void Timer_wheel::schedule(Key key, Clock::time_point deadline) {
+  if (touch(key, deadline)) {
+    return;
+  }
+
+  uint32_t index;
+
+  if (m_free != NIL) {
+    index = m_free;
+    m_free = m_timers[index].m_next;
+  } else {
+    index = uint32_t(m_timers.size());
+    m_timers.emplace_back();
+  }
+
+  /* Due now, it fires on the next tick, this tick's slot has been processed. */
+  m_timers[index].m_key = key;
+  m_timers[index].m_deadline = std::max(to_tick(deadline), m_now + 1);
+  m_index.emplace(key, index);
+
+  link(index);
+}
+
+bool Timer_wheel::touch(Key key, Clock::time_point deadline) noexcept {
+  auto it = m_index.find(key);
+
+  if (it == m_index.end()) {
+    return false;
+  }
+
+  auto& timer = m_timers[it->second];
+
+  timer.m_deadline = std::max(to_tick(deadline), m_now + 1);
+
+  /* A later deadline is picked up when its slot comes around, an earlier one can't wait for it. */
+  if (timer.m_deadline < timer.m_linked) {
+    unlink(it->second);
+    link(it->second);
+  }
+
+  return true;
+}
+
+bool Timer_wheel::cancel(Key key) noexcept {
+  auto it = m_index.find(key);
+
+  if (it == m_index.end()) {
+    return false;
+  }
+
+  const auto index = it->second;
+
+  unlink(index);
+  release(index);
+
+  return true;
+}
+
+void Timer_wheel::cascade(size_t level) noexcept {
+  const auto slot = level * SLOTS + ((m_now >> (SLOT_BITS * level)) & (SLOTS - 1));
+  auto index = m_slots[slot];
+
+  m_slots[slot] = NIL;
+
+  while (index != NIL) {
+    const auto next = m_timers[index].m_next;
+
+    link(index);
+    index = next;
+  }
+}
+
+size_t Timer_wheel::advance(Clock::time_point now, std::vector<Key>& expired) {
+  const auto target = now <= m_start ? 0 : uint64_t((now - m_start) / m_tick);
+  const auto n_expired = expired.size();
+
+  while (m_now < target) {
+    ++m_now;
+
+    /* Coarsest first, what comes down from a level may land in the next one's current slot. */
+    size_t top = 0;
+
+    while (top + 1 < LEVELS && (m_now & (span(top + 1) - 1)) == 0) {
+      ++top;
+    }
+
+    for (auto level = top; level > 0; --level) {
+      cascade(level);
+    }
+
+    const auto slot = m_now & (SLOTS - 1);
+    auto index = m_slots[slot];
+
+    m_slots[slot] = NIL;
+
+    while (index != NIL) {
+      const auto next = m_timers[index].m_next;
+
+      if (m_timers[index].m_deadline <= m_now) {
+        expired.push_back(m_timers[index].m_key);
+        release(index);
+      } else {
+        /* Touched since it was linked. */
+        link(index);
+      }
+
+      index = next;
+    }
+  }
+
+  return expired.size() - n_expired;
+}
+
+} // namespace mesh
@@ -1,7 +1,23 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <optional>
 #include <thread>
 
+#include <liburing.h>
+#include <netinet/udp.h>
+
+#include "libudp/busy_poll_socket.h"
+#include "libudp/executor.h"
 #include "libudp/socket.h"
+#include "libudp/socket_group.h"
+#include "mesh/dedup.h"
+#include "mesh/message.h"
+#include "mesh/node.h"
+#include "mesh/peer_table.h"
+#include "mesh/rcu.h"
+#include "mesh/timer_wheel.h"
 
 class Socket_test : public ::testing::Test {
 protected:
@@ -25,26 +41,18 @@ TEST_F(Socket_test, SendReceive) {
     auto server_receive_task = server.receive_async(receive_buffer);
     auto client_send_task = client.send_async("127.0.0.1", 12346, send_data.data(), send_data.size());
 
-    if (!client_send_task.is_done()) {
-        client_send_task.resume();
-    }
+    client.run_until(client_send_task);
 
-    if (!server_receive_task.is_done()) {
-        server_receive_task.resume();
-    }
+    server.run_until(server_receive_task);
 
     std::string message(receive_buffer.begin(), receive_buffer.end());
 
     auto server_send_task = server.send_async("127.0.0.1", 12345, message.data(), message.size());
     auto client_receive_task = client.receive_async(receive_buffer);
 
-    if (!server_send_task.is_done()) {
-        server_send_task.resume();
-    }
+    server.run_until(server_send_task);
 
-    if (!client_receive_task.is_done()) {
-        client_receive_task.resume();
-    }
+    client.run_until(client_receive_task);
 
     auto sent_bytes = client_send_task.get_result();
     auto received_bytes = client_receive_task.get_result();
@@ -53,3 +61,1630 @@ TEST_F(Socket_test, SendReceive) {
     EXPECT_EQ(received_bytes, send_data.size());
     EXPECT_EQ(receive_buffer[0], send_data[0]);
 }
+
+TEST_F(Socket_test, MultishotReceive) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket client(12347);
+    udp::Socket server(12348);
+
+    server.enable_multishot_receive(8, 2048);
+
+    const std::string messages[] = {"one", "two", "three"};
+
+    for (const auto& message : messages) {
+        auto send_task = client.send_async("127.0.0.1", 12348, message.data(), message.size());
+
+        client.run_until(send_task);
+
+        EXPECT_EQ(send_task.get_result(), message.size());
+    }
+
+    for (const auto& message : messages) {
+        udp::Datagram_lease lease;
+
+        auto receive_task = server.receive_async(lease);
+
+        server.run_until(receive_task);
+
+        ASSERT_EQ(receive_task.get_result(), message.size());
+        EXPECT_EQ(std::string(lease.data().begin(), lease.data().end()), message);
+        EXPECT_EQ(ntohs(lease.from().sin_port), 12347);
+    }
+
+    EXPECT_TRUE(server.m_multishot_receive->m_is_armed);
+}
+
+TEST_F(Socket_test, MultishotReceiveRounds) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket client(12389);
+    udp::Socket server(12390);
+
+    server.enable_multishot_receive(8, 2048);
+
+    udp::Buffer reply(64);
+
+    /* One datagram per round, every receive waits on the armed multishot again.
+     * The echo submits on the server's ring, anything left in its SQ goes with it. */
+    for (int round = 0; round < 8; ++round) {
+        const auto message = "round " + std::to_string(round);
+        udp::Datagram_lease lease;
+
+        auto receive_task = server.receive_async(lease);
+
+        receive_task.start();
+
+        auto send_task = client.send_async("127.0.0.1", 12390, message.data(), message.size());
+
+        client.run_until(send_task);
+        server.run_until(receive_task);
+
+        ASSERT_EQ(receive_task.get_result(), message.size());
+        EXPECT_EQ(std::string(lease.data().begin(), lease.data().end()), message);
+
+        /* Waiting on the armed receive left no SQE behind for the next submit. */
+        EXPECT_EQ(io_uring_sq_ready(server.m_ring.get()), 0u);
+
+        auto echo_task = server.send_async("127.0.0.1", 12389, lease.data().data(), int(lease.data().size()));
+
+        server.run_until(echo_task);
+
+        auto reply_task = client.receive_async(reply);
+
+        client.run_until(reply_task);
+
+        EXPECT_EQ(reply_task.get_result(), message.size());
+
+        /* Only the multishot receive is left. */
+        EXPECT_EQ(server.m_reactor.in_flight(), 1u);
+    }
+}
+
+TEST_F(Socket_test, SendBatch) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket client(12349);
+    udp::Socket server(12350);
+
+    const std::string messages[] = {"alpha", "beta", "gamma", "delta"};
+
+    /* Deeper than the ring to exercise the SQ full path. */
+    std::vector<udp::Outgoing_datagram> datagrams(40);
+
+    for (size_t i = 0; i < datagrams.size(); ++i) {
+        const auto& message = messages[i % std::size(messages)];
+
+        datagrams[i].m_addr.sin_family = AF_INET;
+        datagrams[i].m_addr.sin_port = htons(12350);
+        datagrams[i].m_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        datagrams[i].m_data = message.data();
+        datagrams[i].m_n_bytes = message.size();
+    }
+
+    auto send_task = client.send_batch(datagrams);
+
+    client.run_until(send_task);
+
+    EXPECT_EQ(send_task.get_result(), datagrams.size());
+
+    for (size_t i = 0; i < datagrams.size(); ++i) {
+        EXPECT_EQ(datagrams[i].m_result, datagrams[i].m_n_bytes);
+    }
+
+    udp::Buffer receive_buffer(64);
+
+    auto receive_task = server.receive_async(receive_buffer);
+
+    server.run_until(receive_task);
+
+    EXPECT_EQ(receive_task.get_result(), messages[0].size());
+}
+
+TEST_F(Socket_test, SendSegmented) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket client(12351);
+    udp::Socket server(12352);
+
+    constexpr uint16_t segment_size = 1000;
+
+    udp::Buffer send_data(3 * segment_size + 500);
+
+    for (size_t i = 0; i < send_data.size(); ++i) {
+        send_data[i] = uint8_t(i);
+    }
+
+    auto send_task = client.send_async("127.0.0.1", 12352, send_data.data(), send_data.size(), segment_size);
+
+    client.run_until(send_task);
+
+    EXPECT_EQ(send_task.get_result(), send_data.size());
+
+    for (size_t offset = 0; offset < send_data.size(); offset += segment_size) {
+        const auto expected = std::min<size_t>(segment_size, send_data.size() - offset);
+        udp::Buffer receive_buffer(4096);
+
+        auto receive_task = server.receive_async(receive_buffer);
+
+        server.run_until(receive_task);
+
+        ASSERT_EQ(receive_task.get_result(), expected);
+        EXPECT_EQ(receive_buffer[0], send_data[offset]);
+    }
+}
+
+TEST_F(Socket_test, ReceiveCoalesced) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket client(12353);
+    udp::Socket server(12354);
+
+    server.enable_gro();
+
+    constexpr uint16_t segment_size = 1000;
+
+    udp::Buffer send_data(3 * segment_size + 500);
+
+    for (size_t i = 0; i < send_data.size(); ++i) {
+        send_data[i] = uint8_t(i);
+    }
+
+    /* A GSO send is delivered unsplit to a GRO socket on loopback. */
+    auto send_task = client.send_async("127.0.0.1", 12354, send_data.data(), send_data.size(), segment_size);
+
+    client.run_until(send_task);
+
+    udp::Buffer receive_buffer(65536);
+    udp::Datagram_segments segments;
+
+    auto receive_task = server.receive_async(receive_buffer, segments);
+
+    server.run_until(receive_task);
+
+    ASSERT_EQ(receive_task.get_result(), send_data.size());
+    ASSERT_EQ(segments.size(), 4);
+
+    size_t offset{};
+
+    for (auto segment : segments) {
+        EXPECT_EQ(segment.size(), std::min<size_t>(segment_size, send_data.size() - offset));
+        EXPECT_EQ(segment[0], send_data[offset]);
+        offset += segment.size();
+    }
+
+    EXPECT_EQ(offset, send_data.size());
+}
+
+TEST_F(Socket_test, ConcurrentOperations) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket client(12355);
+    udp::Socket server(12356);
+
+    constexpr size_t n_operations = 4;
+
+    std::vector<udp::Buffer> receive_buffers(n_operations, udp::Buffer(16));
+    std::vector<udp::Task<int>> receive_tasks;
+
+    /* All receives in flight on the same ring at once. */
+    for (auto& buffer : receive_buffers) {
+        receive_tasks.push_back(server.receive_async(buffer));
+        receive_tasks.back().start();
+    }
+
+    for (const auto& task : receive_tasks) {
+        EXPECT_FALSE(task.is_done());
+    }
+
+    const std::string message{"ping"};
+    std::vector<udp::Task<int>> send_tasks;
+
+    for (size_t i = 0; i < n_operations; ++i) {
+        send_tasks.push_back(client.send_async("127.0.0.1", 12356, message.data(), message.size()));
+        send_tasks.back().start();
+    }
+
+    for (auto& task : send_tasks) {
+        client.run_until(task);
+        EXPECT_EQ(task.get_result(), message.size());
+    }
+
+    /* Completing the last one dispatches the completions of the others as well. */
+    server.run_until(receive_tasks.back());
+
+    for (auto& task : receive_tasks) {
+        server.run_until(task);
+        EXPECT_EQ(task.get_result(), message.size());
+    }
+}
+
+TEST_F(Socket_test, RegisteredSend) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket client(12357);
+    udp::Socket server(12358);
+
+    client.enable_registered_resources(2, 1024);
+    server.enable_registered_resources(1, 1024);
+
+    auto buffer = client.acquire_send_buffer();
+    auto other = client.acquire_send_buffer();
+
+    ASSERT_TRUE(buffer.is_valid());
+    ASSERT_TRUE(other.is_valid());
+
+    /* The pool is exhausted until a buffer is released. */
+    EXPECT_FALSE(client.acquire_send_buffer().is_valid());
+
+    other.release();
+    EXPECT_TRUE(client.acquire_send_buffer().is_valid());
+
+    const std::string message{"registered"};
+
+    std::memcpy(buffer.data().data(), message.data(), message.size());
+
+    udp::Buffer receive_buffer(64);
+
+    /* The receive goes through the fixed file as well. */
+    auto receive_task = server.receive_async(receive_buffer);
+    auto send_task = client.send_async("127.0.0.1", 12358, buffer, message.size());
+
+    client.run_until(send_task);
+    server.run_until(receive_task);
+
+    EXPECT_EQ(send_task.get_result(), message.size());
+    ASSERT_EQ(receive_task.get_result(), message.size());
+    EXPECT_EQ(std::string(receive_buffer.begin(), receive_buffer.begin() + message.size()), message);
+
+    /* Without SEND_ZC the registered buffer is sent with a copying IORING_OP_SEND. */
+    client.m_zero_copy_supported = false;
+
+    const std::string copied{"copied"};
+
+    std::memcpy(buffer.data().data(), copied.data(), copied.size());
+
+    auto copy_receive_task = server.receive_async(receive_buffer);
+    auto copy_send_task = client.send_async("127.0.0.1", 12358, buffer, copied.size());
+
+    client.run_until(copy_send_task);
+    server.run_until(copy_receive_task);
+
+    EXPECT_EQ(copy_send_task.get_result(), copied.size());
+    ASSERT_EQ(copy_receive_task.get_result(), copied.size());
+    EXPECT_EQ(std::string(receive_buffer.begin(), receive_buffer.begin() + copied.size()), copied);
+}
+
+TEST_F(Socket_test, ConfiguredRing) {
+    Logger::get_instance().set_level(Logger::Level::ERROR);
+
+    udp::Socket_config taskrun_config{};
+
+    taskrun_config.m_ring_depth = 256;
+    taskrun_config.m_cq_size = 1024;
+    taskrun_config.m_coop_taskrun = true;
+    taskrun_config.m_defer_taskrun = true;
+
+    udp::Socket_config sqpoll_config{};
+
+    sqpoll_config.m_ring_depth = 64;
+    sqpoll_config.m_sqpoll = true;
+    sqpoll_config.m_sqpoll_idle_ms = 10;
+    sqpoll_config.m_sqpoll_cpu = 0;
+
+    /* Whatever the kernel accepts, the sockets must work. */
+    udp::Socket client(12359, sqpoll_config);
+    udp::Socket server(12360, taskrun_config);
+
+    const std::string message{"configured"};
+    udp::Buffer receive_buffer(64);
+
+    auto receive_task = server.receive_async(receive_buffer);
+    auto send_task = client.send_async("127.0.0.1", 12360, message.data(), message.size());
+
+    client.run_until(send_task);
+    server.run_until(receive_task);
+
+    EXPECT_EQ(send_task.get_result(), message.size());
+    EXPECT_EQ(receive_task.get_result(), message.size());
+}
+
+TEST_F(Socket_test, ZeroCopySend) {
+    Logger::get_instance().set_level(Logger::Level::ERROR);
+
+    udp::Socket client(12361);
+    udp::Socket server(12362);
+
+    /* Supported or not, the sends must behave the same. */
+    client.enable_zero_copy_send(1024);
+
+    udp::Buffer send_data(16 * 1024);
+
+    for (size_t i = 0; i < send_data.size(); ++i) {
+        send_data[i] = uint8_t(i * 7);
+    }
+
+    auto send_task = client.send_async("127.0.0.1", 12362, send_data.data(), send_data.size());
+
+    client.run_until(send_task);
+
+    EXPECT_EQ(send_task.get_result(), send_data.size());
+
+    std::vector<udp::Outgoing_datagram> datagrams(3);
+
+    for (auto& datagram : datagrams) {
+        datagram.m_addr.sin_family = AF_INET;
+        datagram.m_addr.sin_port = htons(12362);
+        datagram.m_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        datagram.m_data = send_data.data();
+        datagram.m_n_bytes = send_data.size();
+    }
+
+    /* The last one is below the threshold and copied. */
+    datagrams.back().m_n_bytes = 100;
+
+    auto batch_task = client.send_batch(datagrams);
+
+    client.run_until(batch_task);
+
+    EXPECT_EQ(batch_task.get_result(), datagrams.size());
+
+    for (const auto& datagram : datagrams) {
+        EXPECT_EQ(datagram.m_result, datagram.m_n_bytes);
+    }
+
+    udp::Buffer receive_buffer(65536);
+
+    for (size_t i = 0; i <= datagrams.size(); ++i) {
+        auto receive_task = server.receive_async(receive_buffer);
+
+        server.run_until(receive_task);
+
+        EXPECT_EQ(receive_task.get_result(), i < datagrams.size() ? send_data.size() : 100);
+        EXPECT_EQ(receive_buffer[1], send_data[1]);
+    }
+}
+
+TEST_F(Socket_test, ZeroCopyBatchFallback) {
+    Logger::get_instance().set_level(Logger::Level::ERROR);
+
+    udp::Socket client(12393);
+    udp::Socket server(12394);
+
+    /* A raw socket doesn't support zero-copy, the kernel rejects the sends with EOPNOTSUPP. */
+    const auto raw = socket(AF_INET, SOCK_RAW, IPPROTO_UDP);
+
+    if (raw < 0) {
+        GTEST_SKIP() << "Raw sockets need CAP_NET_RAW";
+    }
+
+    ASSERT_GE(dup2(raw, client.m_socket_fd), 0);
+    close(raw);
+
+    client.enable_zero_copy_send(0);
+
+    /* The raw socket sends the UDP header as part of the payload. */
+    constexpr size_t payload_size = 64;
+    udp::Buffer send_data(sizeof(udphdr) + payload_size);
+    auto header = reinterpret_cast<udphdr*>(send_data.data());
+
+    header->source = htons(12393);
+    header->dest = htons(12394);
+    header->len = htons(uint16_t(send_data.size()));
+    header->check = 0;
+
+    for (size_t i = 0; i < payload_size; ++i) {
+        send_data[sizeof(udphdr) + i] = uint8_t(i * 3);
+    }
+
+    std::vector<udp::Outgoing_datagram> datagrams(3);
+
+    for (auto& datagram : datagrams) {
+        datagram.m_addr.sin_family = AF_INET;
+        datagram.m_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        datagram.m_data = send_data.data();
+        datagram.m_n_bytes = send_data.size();
+    }
+
+    udp::Buffer receive_buffer(65536);
+
+    /* The first batch is resent copying, the second one doesn't try zero-copy anymore. */
+    for (int round = 0; round < 2; ++round) {
+        auto batch_task = client.send_batch(datagrams);
+
+        client.run_until(batch_task);
+
+        EXPECT_EQ(batch_task.get_result(), datagrams.size());
+        EXPECT_FALSE(client.m_zero_copy_send);
+
+        for (const auto& datagram : datagrams) {
+            EXPECT_EQ(datagram.m_result, datagram.m_n_bytes);
+
+            auto receive_task = server.receive_async(receive_buffer);
+
+            server.run_until(receive_task);
+
+            EXPECT_EQ(receive_task.get_result(), payload_size);
+            EXPECT_EQ(receive_buffer[1], send_data[sizeof(udphdr) + 1]);
+        }
+    }
+}
+
+TEST_F(Socket_test, SocketGroup) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    constexpr size_t n_datagrams = 20;
+
+    std::atomic<size_t> n_handled{};
+    std::atomic<size_t> n_wrong_thread{};
+    std::atomic<size_t> n_leaked{};
+
+    udp::Socket_group_config config;
+
+    config.m_n_shards = 2;
+    config.m_n_buffers = 16;
+
+    udp::Socket_group group(12363, [&](size_t shard, udp::Socket& socket, const udp::Datagram_lease& lease) {
+        if (std::this_thread::get_id() != group.m_shards[shard]->m_thread.get_id()) {
+            ++n_wrong_thread;
+        }
+
+        /* The wakeup read and the multishot receive, idle waits in between took no SQE. */
+        if (socket.m_reactor.in_flight() != 2 || io_uring_sq_ready(socket.m_ring.get()) != 0) {
+            ++n_leaked;
+        }
+
+        EXPECT_EQ(lease.data().size(), 4);
+        ++n_handled;
+    }, config);
+
+    group.start();
+
+    EXPECT_EQ(group.size(), 2);
+
+    udp::Socket client(12364);
+    const std::string send_data = "ping";
+
+    /* A few datagrams per reactor round, the shards go idle in between. */
+    for (size_t i = 0; i < n_datagrams; ++i) {
+        auto send_task = client.send_async("127.0.0.1", 12363, send_data.data(), send_data.size());
+
+        client.run_until(send_task);
+
+        EXPECT_EQ(send_task.get_result(), send_data.size());
+
+        if (i % 5 == 4) {
+            for (int j = 0; j < 200 && n_handled < i + 1; ++j) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    for (int i = 0; i < 200 && n_handled < n_datagrams; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    group.stop();
+
+    EXPECT_EQ(n_handled, n_datagrams);
+    EXPECT_EQ(n_wrong_thread, 0);
+    EXPECT_EQ(n_leaked, 0);
+    EXPECT_EQ(group.m_shards[0]->m_n_received + group.m_shards[1]->m_n_received, n_datagrams);
+}
+
+TEST_F(Socket_test, SendResolved) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket client(12365);
+    udp::Socket server(12366);
+
+    sockaddr_in addr;
+
+    EXPECT_FALSE(udp::resolve("not-an-address", 12366, addr));
+    ASSERT_TRUE(udp::resolve("127.0.0.1", 12366, addr));
+
+    const std::string send_data = "resolved";
+    udp::Buffer receive_buffer(1024);
+
+    for (int i = 0; i < 3; ++i) {
+        auto send_task = client.send_async(addr, send_data.data(), int(send_data.size()));
+
+        client.run_until(send_task);
+
+        EXPECT_EQ(send_task.get_result(), send_data.size());
+
+        auto receive_task = server.receive_async(receive_buffer);
+
+        server.run_until(receive_task);
+
+        EXPECT_EQ(receive_task.get_result(), send_data.size());
+        EXPECT_EQ(std::string(receive_buffer.begin(), receive_buffer.begin() + send_data.size()), send_data);
+    }
+}
+
+TEST_F(Socket_test, BusyPollSendReceive) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Busy_poll_socket client(12367);
+    udp::Busy_poll_socket server(12368);
+
+    sockaddr_in addr;
+
+    ASSERT_TRUE(udp::resolve("127.0.0.1", 12368, addr));
+
+    const std::string send_data = "busy poll";
+    std::vector<udp::Outgoing_datagram> datagrams(4);
+
+    for (auto& datagram : datagrams) {
+        datagram.m_addr = addr;
+        datagram.m_data = send_data.data();
+        datagram.m_n_bytes = int(send_data.size());
+    }
+
+    auto batch_task = client.send_batch(datagrams);
+
+    client.run_until(batch_task);
+
+    EXPECT_EQ(batch_task.get_result(), datagrams.size());
+
+    auto send_task = client.send_async(addr, send_data.data(), int(send_data.size()));
+
+    client.run_until(send_task);
+
+    EXPECT_EQ(send_task.get_result(), send_data.size());
+
+    /* Both receives are queued before the socket is polled, one recvmmsg completes them. */
+    udp::Buffer buffer_1(1024);
+    udp::Buffer buffer_2(1024);
+
+    for (int i = 0; i < 2; ++i) {
+        auto receive_task_1 = server.receive_async(buffer_1);
+        auto receive_task_2 = server.receive_async(buffer_2);
+
+        receive_task_1.start();
+        receive_task_2.start();
+
+        server.run_until(receive_task_2);
+
+        EXPECT_TRUE(receive_task_1.is_done());
+        EXPECT_EQ(receive_task_1.get_result(), send_data.size());
+        EXPECT_EQ(receive_task_2.get_result(), send_data.size());
+    }
+
+    /* The io_uring socket talks to the busy poll one through the common interface. */
+    udp::Socket uring_client(12369);
+    udp::Transport& transport = uring_client;
+
+    auto uring_send_task = transport.send_async(addr, send_data.data(), int(send_data.size()));
+
+    transport.run_until(uring_send_task);
+
+    auto receive_task = server.receive_async(buffer_1);
+
+    server.run_until(receive_task);
+
+    EXPECT_EQ(receive_task.get_result(), send_data.size());
+    EXPECT_EQ(std::string(buffer_1.begin(), buffer_1.begin() + send_data.size()), send_data);
+
+    /* The timers fire at their deadline, not before and not much later. On an idle socket, nothing is queued for it. */
+    udp::Busy_poll_socket idle(12397);
+    constexpr auto duration = std::chrono::milliseconds(20);
+    auto start = std::chrono::steady_clock::now();
+    auto sleep_task = idle.sleep_async(duration);
+
+    idle.run_until(sleep_task);
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(sleep_task.get_result(), 0);
+    EXPECT_GE(elapsed, duration);
+    EXPECT_LT(elapsed, std::chrono::seconds(1));
+
+    /* Nobody sends, the receive times out at its deadline. */
+    start = std::chrono::steady_clock::now();
+
+    auto timed_receive_task = idle.receive_async(buffer_1, start + duration);
+
+    idle.run_until(timed_receive_task);
+
+    elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(timed_receive_task.get_result(), -ETIMEDOUT);
+    EXPECT_GE(elapsed, duration);
+    EXPECT_LT(elapsed, std::chrono::seconds(1));
+}
+
+TEST_F(Socket_test, PooledFrames) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket client(12370);
+    udp::Socket server(12371);
+
+    sockaddr_in addr;
+
+    ASSERT_TRUE(udp::resolve("127.0.0.1", 12371, addr));
+
+    const std::string send_data = "pooled";
+    udp::Buffer receive_buffer(1024);
+
+    auto send_receive = [&]() {
+        auto send_task = client.send_async(addr, send_data.data(), int(send_data.size()));
+
+        client.run_until(send_task);
+
+        auto receive_task = server.receive_async(receive_buffer);
+
+        server.run_until(receive_task);
+
+        EXPECT_EQ(receive_task.get_result(), send_data.size());
+    };
+
+    /* Warm up the freelists. */
+    send_receive();
+
+    const auto before = udp::Frame_pool::stats();
+
+    for (int i = 0; i < 100; ++i) {
+        send_receive();
+    }
+
+    const auto& after = udp::Frame_pool::stats();
+
+    /* Steady state, every frame is recycled. */
+    EXPECT_EQ(after.m_n_misses, before.m_n_misses);
+    EXPECT_EQ(after.m_n_hits - before.m_n_hits, 200);
+    EXPECT_GT(after.hit_rate(), before.hit_rate());
+}
+
+static udp::Task<int> count_down(int n) {
+    if (n == 0) {
+        co_return 0;
+    }
+
+    co_return co_await count_down(n - 1) + 1;
+}
+
+static udp::Task<int> fail() {
+    throw std::runtime_error("failed");
+    co_return 0;
+}
+
+static udp::Task<int> catch_failure() {
+    try {
+        co_await fail();
+    } catch (const std::runtime_error&) {
+        co_return -1;
+    }
+
+    co_return 0;
+}
+
+TEST_F(Socket_test, TaskChain) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    /* Lazy, nothing runs until the task is started or awaited. */
+    auto task = count_down(10000);
+
+    EXPECT_FALSE(task.is_done());
+
+    task.start();
+
+    /* Every level completes synchronously and transfers to its awaiter. */
+    EXPECT_TRUE(task.is_done());
+    EXPECT_EQ(task.get_result(), 10000);
+
+    auto failure_task = catch_failure();
+
+    failure_task.start();
+
+    EXPECT_TRUE(failure_task.is_done());
+    EXPECT_EQ(failure_task.get_result(), -1);
+
+    /* A chain suspended on I/O is resumed by the reactor, the socket sends to itself. */
+    udp::Socket socket(12372);
+
+    sockaddr_in addr;
+
+    ASSERT_TRUE(udp::resolve("127.0.0.1", 12372, addr));
+
+    const std::string send_data = "chain";
+    udp::Buffer receive_buffer(1024);
+
+    auto exchange = [&]() -> udp::Task<int> {
+        const auto n_sent = co_await socket.send_async(addr, send_data.data(), int(send_data.size()));
+
+        EXPECT_EQ(n_sent, send_data.size());
+
+        co_return co_await socket.receive_async(receive_buffer);
+    };
+
+    auto exchange_task = exchange();
+
+    socket.run_until(exchange_task);
+
+    EXPECT_EQ(exchange_task.get_result(), send_data.size());
+}
+
+TEST_F(Socket_test, SleepAsync) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket socket(12374);
+    udp::Busy_poll_socket busy_poll_socket(12375);
+
+    for (udp::Transport* transport : {static_cast<udp::Transport*>(&socket), static_cast<udp::Transport*>(&busy_poll_socket)}) {
+        constexpr int n_timers = 100;
+
+        std::vector<udp::Task<int>> timers;
+
+        const auto start = std::chrono::steady_clock::now();
+
+        /* All the timers are pending on the one loop at once. */
+        for (int i = 0; i < n_timers; ++i) {
+            timers.push_back(transport->sleep_async(std::chrono::milliseconds(1 + i % 10)));
+            timers.back().start();
+        }
+
+        for (auto& timer : timers) {
+            transport->run_until(timer);
+            EXPECT_EQ(timer.get_result(), 0);
+        }
+
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        EXPECT_GE(elapsed, std::chrono::milliseconds(10));
+        EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+    }
+}
+
+TEST_F(Socket_test, ReceiveDeadline) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket socket(12376);
+    udp::Busy_poll_socket busy_poll_socket(12377);
+
+    for (udp::Transport* transport : {static_cast<udp::Transport*>(&socket), static_cast<udp::Transport*>(&busy_poll_socket)}) {
+        udp::Buffer receive_buffer(1024);
+
+        /* Nothing to receive, the deadline cancels the receive. */
+        const auto start = std::chrono::steady_clock::now();
+
+        auto receive_task = transport->receive_async(receive_buffer, start + std::chrono::milliseconds(20));
+
+        transport->run_until(receive_task);
+
+        EXPECT_EQ(receive_task.get_result(), -ETIMEDOUT);
+        EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+
+        /* The transport sends to itself, the datagram arrives before the deadline. */
+        const auto port = transport == &socket ? 12376 : 12377;
+        const std::string send_data = "deadline";
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+        sockaddr_in addr;
+
+        ASSERT_TRUE(udp::resolve("127.0.0.1", port, addr));
+
+        auto send_task = transport->send_async(addr, send_data.data(), int(send_data.size()), deadline);
+
+        transport->run_until(send_task);
+
+        EXPECT_EQ(send_task.get_result(), send_data.size());
+
+        receive_task = transport->receive_async(receive_buffer, deadline);
+
+        transport->run_until(receive_task);
+
+        EXPECT_EQ(receive_task.get_result(), send_data.size());
+    }
+}
+
+TEST_F(Socket_test, CancelAll) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket socket(12378);
+    udp::Busy_poll_socket busy_poll_socket(12379);
+
+    for (udp::Transport* transport : {static_cast<udp::Transport*>(&socket), static_cast<udp::Transport*>(&busy_poll_socket)}) {
+        std::vector<udp::Buffer> buffers(4, udp::Buffer(1024));
+        std::vector<udp::Task<int>> tasks;
+
+        for (auto& buffer : buffers) {
+            tasks.push_back(transport->receive_async(buffer));
+            tasks.back().start();
+        }
+
+        tasks.push_back(transport->sleep_async(std::chrono::seconds(10)));
+        tasks.back().start();
+
+        const auto start = std::chrono::steady_clock::now();
+
+        EXPECT_EQ(transport->cancel_all(), tasks.size());
+
+        /* Resumed right away, nothing arrived and the timer hasn't expired. */
+        EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+        for (auto& task : tasks) {
+            EXPECT_TRUE(task.is_done());
+            EXPECT_EQ(task.get_result(), -ECANCELED);
+        }
+    }
+
+    /* Closing resumes the operations still in flight. */
+    udp::Socket closing_socket(12380);
+    udp::Buffer buffer(1024);
+
+    auto receive_task = closing_socket.receive_async(buffer);
+
+    receive_task.start();
+    closing_socket.close();
+
+    EXPECT_TRUE(receive_task.is_done());
+    EXPECT_EQ(receive_task.get_result(), -ECANCELED);
+}
+
+TEST_F(Socket_test, Executor) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Executor executor(2);
+    udp::Socket socket(12381);
+
+    socket.enable_post();
+
+    const auto ring_thread = std::this_thread::get_id();
+
+    /* Hop onto a worker for the CPU work and back onto the ring thread for the send. */
+    std::thread::id worker_thread;
+    bool is_back_on_ring{};
+
+    auto hop = [&]() -> udp::Task<int> {
+        co_await executor.schedule();
+        worker_thread = std::this_thread::get_id();
+
+        co_await socket.schedule();
+        is_back_on_ring = std::this_thread::get_id() == ring_thread;
+
+        const std::string message{"hop"};
+
+        co_return co_await socket.send_async("127.0.0.1", 12381, message.data(), message.size());
+    };
+
+    auto hop_task = hop();
+
+    socket.run_until(hop_task);
+
+    EXPECT_NE(worker_thread, ring_thread);
+    EXPECT_TRUE(is_back_on_ring);
+    EXPECT_EQ(hop_task.get_result(), 3);
+
+    /* Fan out over the workers, the join resumes on the ring thread. */
+    constexpr size_t n_tasks = 256;
+    std::atomic<size_t> n_ran{};
+    udp::Fan_in fan_in(socket, n_tasks);
+
+    auto work = [&]() -> udp::Detached_task {
+        co_await executor.schedule();
+        ++n_ran;
+        fan_in.arrive();
+    };
+
+    auto join = [&](udp::Fan_in& join_point) -> udp::Task<int> {
+        for (size_t i = 0; i < n_tasks; ++i) {
+            work();
+        }
+
+        co_await join_point;
+
+        co_return std::this_thread::get_id() == ring_thread;
+    };
+
+    auto join_task = join(fan_in);
+
+    socket.run_until(join_task);
+
+    EXPECT_EQ(join_task.get_result(), 1);
+    EXPECT_EQ(n_ran.load(), n_tasks);
+
+    uint64_t n_executed{};
+
+    for (const auto& worker : executor.m_workers) {
+        n_executed += worker->m_n_executed.load();
+    }
+
+    EXPECT_EQ(n_executed, n_tasks + 1);
+}
+
+TEST_F(Socket_test, MessageView) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    mesh::Message message;
+
+    message.m_header.m_type = mesh::Message_type::Data;
+    message.m_header.m_message_id = 0x0102030405060708;
+    message.m_header.m_source_id = "127.0.0.1:8080";
+    message.m_header.m_ttl = 0x0a0b;
+    message.m_payload = {'p', 'a', 'y', 'l', 'o', 'a', 'd'};
+
+    const auto bytes = mesh::Serialize{}(message);
+
+    ASSERT_EQ(bytes.size(), mesh::Message_view::MIN_SIZE + 14 + 7);
+
+    /* Little-endian on the wire whatever the host's byte order. */
+    EXPECT_EQ(bytes[1], 0x08);
+    EXPECT_EQ(bytes[8], 0x01);
+    EXPECT_EQ(bytes[9], 14);
+    EXPECT_EQ(bytes[10], 0);
+
+    mesh::Message_view view;
+
+    ASSERT_TRUE(view.parse(bytes));
+    EXPECT_EQ(view.m_type, mesh::Message_type::Data);
+    EXPECT_EQ(view.m_message_id, message.m_header.m_message_id);
+    EXPECT_EQ(view.m_source_id, "127.0.0.1:8080");
+    EXPECT_EQ(view.m_ttl, message.m_header.m_ttl);
+
+    /* Points into the datagram, nothing was copied. */
+    EXPECT_EQ(view.m_payload.data(), bytes.data() + bytes.size() - 7);
+    EXPECT_EQ(view.m_payload.size(), 7);
+
+    const auto copy = mesh::Deserialize{}(bytes);
+
+    EXPECT_EQ(copy.m_header.m_source_id, message.m_header.m_source_id);
+    EXPECT_EQ(copy.m_payload, message.m_payload);
+
+    /* Every truncation short of the payload is rejected. */
+    for (size_t n_bytes = 0; n_bytes < bytes.size() - 7; ++n_bytes) {
+        EXPECT_FALSE(view.parse(std::span<const uint8_t>(bytes.data(), n_bytes))) << n_bytes;
+        EXPECT_FALSE(view.is_valid());
+    }
+
+    auto bad_type = bytes;
+
+    bad_type[0] = 0xff;
+    EXPECT_FALSE(view.parse(bad_type));
+    EXPECT_EQ(mesh::Deserialize{}(bad_type).m_header.m_type, mesh::Message_type::None);
+}
+
+TEST_F(Socket_test, RetainedMessage) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    /* Handlers keep every event, later datagrams must not overwrite the kept bytes. */
+    const std::string messages[] = {"first", "second", "third"};
+    std::vector<std::shared_ptr<mesh::events::Message_received>> kept;
+    std::atomic<size_t> n_received{};
+    std::atomic<bool> started{};
+    std::atomic<bool> done{};
+
+    std::thread node_thread([&]() {
+        auto node = std::make_shared<mesh::Node>(mesh::Endpoint("127.0.0.1", 12391));
+
+        node->subscribe("Message_received", [&](const std::shared_ptr<mesh::events::Event>& event) -> udp::Task<mesh::Node*> {
+            kept.push_back(std::static_pointer_cast<mesh::events::Message_received>(event));
+            ++n_received;
+            co_return;
+        });
+
+        auto run = [&]() -> udp::Task<mesh::Node*> {
+            co_await node->start();
+
+            started = true;
+
+            while (!done) {
+                co_await node->sleep_async(std::chrono::milliseconds(5));
+            }
+
+            co_await node->stop();
+        };
+
+        auto task = run();
+
+        node->run_until(task);
+    });
+
+    while (!started) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    udp::Socket client(12392);
+
+    for (size_t i = 0; i < std::size(messages); ++i) {
+        auto send_task = client.send_async("127.0.0.1", 12391, messages[i].data(), int(messages[i].size()));
+
+        client.run_until(send_task);
+
+        for (int j = 0; j < 1000 && n_received <= i; ++j) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    done = true;
+    node_thread.join();
+
+    ASSERT_EQ(kept.size(), std::size(messages));
+
+    for (size_t i = 0; i < kept.size(); ++i) {
+        EXPECT_EQ(std::string(kept[i]->m_data.begin(), kept[i]->m_data.end()), messages[i]);
+        EXPECT_FALSE(kept[i]->m_message.is_valid());
+
+        if (i > 0) {
+            EXPECT_NE(kept[i]->m_buffer, kept[i - 1]->m_buffer);
+        }
+    }
+}
+
+TEST_F(Socket_test, NodeExecutorHandlers) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    /* A handler on a worker broadcasts without scheduling, the node moves it to its thread. */
+    udp::Executor executor(2);
+    std::thread::id node_thread_id;
+    std::thread::id handler_thread_id;
+    std::thread::id after_broadcast_thread_id;
+    std::atomic<bool> started{};
+    std::atomic<bool> handled{};
+    std::atomic<bool> done{};
+
+    std::thread node_thread([&]() {
+        auto node = std::make_shared<mesh::Node>(mesh::Endpoint("127.0.0.1", 12395));
+
+        node_thread_id = std::this_thread::get_id();
+        node->set_executor(executor);
+
+        node->subscribe("Message_received", [&](const std::shared_ptr<mesh::events::Event>&) -> udp::Task<mesh::Node*> {
+            handler_thread_id = std::this_thread::get_id();
+
+            const udp::Buffer payload{'r', 'e', 'p', 'l', 'y'};
+
+            co_await node->broadcast(payload);
+
+            after_broadcast_thread_id = std::this_thread::get_id();
+            handled = true;
+        });
+
+        auto run = [&]() -> udp::Task<mesh::Node*> {
+            co_await node->start();
+
+            started = true;
+
+            while (!done) {
+                co_await node->sleep_async(std::chrono::milliseconds(5));
+            }
+
+            co_await node->stop();
+        };
+
+        auto task = run();
+
+        node->run_until(task);
+    });
+
+    while (!started) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    udp::Socket client(12396);
+    const std::string message{"hello"};
+
+    auto send_task = client.send_async("127.0.0.1", 12395, message.data(), int(message.size()));
+
+    client.run_until(send_task);
+
+    for (int i = 0; i < 1000 && !handled; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    done = true;
+    node_thread.join();
+
+    ASSERT_TRUE(handled);
+    EXPECT_NE(handler_thread_id, node_thread_id);
+    EXPECT_EQ(after_broadcast_thread_id, node_thread_id);
+}
+
+TEST_F(Socket_test, GatheredSend) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    udp::Socket socket(12382);
+    udp::Busy_poll_socket busy_poll_socket(12383);
+
+    /* A mesh header in front of a payload, never concatenated. */
+    const udp::Buffer payload = {'p', 'a', 'y', 'l', 'o', 'a', 'd'};
+    mesh::Header_bytes header;
+    const auto header_size = mesh::encode_header(mesh::Message_type::Data, 42, "127.0.0.1:12382", 3, header);
+
+    ASSERT_GT(header_size, 0);
+
+    const std::array<iovec, 2> iov{{
+        {header.data(), header_size},
+        {const_cast<uint8_t*>(payload.data()), payload.size()}
+    }};
+
+    for (udp::Transport* transport : {static_cast<udp::Transport*>(&socket), static_cast<udp::Transport*>(&busy_poll_socket)}) {
+        sockaddr_in addr;
+
+        ASSERT_TRUE(udp::resolve("127.0.0.1", transport == &socket ? 12382 : 12383, addr));
+
+        /* One gathered send and a batch of two sharing the same iovecs. */
+        std::array<udp::Outgoing_datagram, 2> datagrams{};
+
+        for (auto& datagram : datagrams) {
+            datagram.m_addr = addr;
+            datagram.m_iov = iov;
+        }
+
+        auto send_task = transport->send_async(addr, iov);
+        auto batch_task = transport->send_batch(datagrams);
+
+        transport->run_until(send_task);
+        transport->run_until(batch_task);
+
+        EXPECT_EQ(send_task.get_result(), header_size + payload.size());
+        EXPECT_EQ(batch_task.get_result(), datagrams.size());
+
+        for (int i = 0; i < 3; ++i) {
+            udp::Buffer buffer(1024);
+            auto receive_task = transport->receive_async(buffer);
+
+            transport->run_until(receive_task);
+
+            const auto ret = receive_task.get_result();
+
+            ASSERT_EQ(ret, header_size + payload.size());
+
+            mesh::Message_view view;
+
+            ASSERT_TRUE(view.parse(std::span<const uint8_t>(buffer.data(), size_t(ret))));
+            EXPECT_EQ(view.m_message_id, 42);
+            EXPECT_EQ(view.m_source_id, "127.0.0.1:12382");
+            EXPECT_EQ(view.m_ttl, 3);
+            EXPECT_TRUE(std::equal(view.m_payload.begin(), view.m_payload.end(), payload.begin(), payload.end()));
+        }
+
+        /* More buffers than a send operation holds. */
+        std::vector<iovec> too_many(udp::Send_operation::MAX_IOVECS + 1, iov[1]);
+
+        if (transport == &socket) {
+            auto rejected_task = transport->send_async(addr, too_many);
+
+            transport->run_until(rejected_task);
+
+            EXPECT_EQ(rejected_task.get_result(), -EINVAL);
+        }
+    }
+}
+
+TEST_F(Socket_test, DedupCache) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    mesh::Dedup_cache cache(8);
+    constexpr auto window = mesh::Dedup_cache::WINDOW_SIZE;
+
+    EXPECT_FALSE(cache.is_duplicate("a:1", 1000));
+    EXPECT_TRUE(cache.is_duplicate("a:1", 1000));
+
+    /* The same id from another source is a different message. */
+    EXPECT_FALSE(cache.is_duplicate("b:2", 1000));
+
+    /* Out of order within the window. */
+    EXPECT_FALSE(cache.is_duplicate("a:1", 1005));
+    EXPECT_FALSE(cache.is_duplicate("a:1", 1002));
+    EXPECT_TRUE(cache.is_duplicate("a:1", 1002));
+    EXPECT_FALSE(cache.is_duplicate("a:1", 1001));
+
+    /* Sliding past an id forgets it only once it leaves the window. */
+    EXPECT_FALSE(cache.is_duplicate("a:1", 1000 + window - 1));
+    EXPECT_TRUE(cache.is_duplicate("a:1", 1005));
+    EXPECT_FALSE(cache.is_duplicate("a:1", 1000 + window));
+    EXPECT_TRUE(cache.is_duplicate("a:1", 1000));
+    EXPECT_EQ(cache.stats().m_n_too_old, 1);
+
+    /* A jump larger than the window starts afresh. */
+    EXPECT_FALSE(cache.is_duplicate("a:1", 1000 + 10 * window));
+    EXPECT_FALSE(cache.is_duplicate("a:1", 1000 + 10 * window - 1));
+
+    EXPECT_EQ(cache.stats().m_n_hits, 4);
+    EXPECT_EQ(cache.stats().m_n_misses, 9);
+
+    /* The memory is fixed, more sources than slots evict the least recently seen. */
+    for (int i = 0; i < 16; ++i) {
+        EXPECT_FALSE(cache.is_duplicate("peer:" + std::to_string(i), 1));
+    }
+
+    EXPECT_EQ(cache.m_sources.size(), 8);
+    EXPECT_GE(cache.stats().m_n_evictions, 8);
+    EXPECT_TRUE(cache.is_duplicate("peer:15", 1));
+
+    /* Sources whose hashes collide keep their own windows. */
+    EXPECT_FALSE(cache.is_duplicate("c:3", 7));
+
+    const auto hash = mesh::Dedup_cache::hash("d:4");
+
+    for (auto& source : cache.m_sources) {
+        if (source.id() == "c:3") {
+            auto& slot = cache.m_sources[hash & (cache.m_sources.size() - 1)];
+
+            slot = source;
+            slot.m_hash = hash;
+        }
+    }
+
+    EXPECT_FALSE(cache.is_duplicate("d:4", 7));
+    EXPECT_TRUE(cache.is_duplicate("d:4", 7));
+
+    /* Ids no node can send are dropped. */
+    EXPECT_TRUE(cache.is_duplicate(std::string(mesh::MAX_SOURCE_ID_LENGTH + 1, 'e'), 1));
+}
+
+TEST_F(Socket_test, GossipBroadcast) {
+    Logger::get_instance().set_level(Logger::Level::ERROR);
+
+    /* A triangle, every node a peer of the other two. Each node lives on its own
+     * thread, the thread that drives its ring. */
+    constexpr std::array<uint16_t, 3> ports{12384, 12385, 12386};
+    const mesh::Buffer payload = {'g', 'o', 's', 's', 'i', 'p'};
+
+    std::array<std::atomic<int>, 3> n_delivered{};
+    std::array<uint64_t, 3> n_duplicates{};
+    std::atomic<int> n_started{};
+    std::atomic<int> n_broadcasts{};
+    std::atomic<bool> done{};
+
+    auto run_node = [&](size_t index) {
+        auto node = std::make_shared<mesh::Node>(mesh::Endpoint("127.0.0.1", ports[index]));
+
+        node->subscribe("Message_received", [&, index](const std::shared_ptr<mesh::events::Event>& event) -> udp::Task<mesh::Node*> {
+            auto received = std::static_pointer_cast<mesh::events::Message_received>(event);
+            const auto& payload_view = received->m_message.m_payload;
+
+            if (std::equal(payload_view.begin(), payload_view.end(), payload.begin(), payload.end())) {
+                ++n_delivered[index];
+            }
+            co_return;
+        });
+
+        auto run = [&]() -> udp::Task<mesh::Node*> {
+            co_await node->start();
+
+            for (size_t i = 0; i < ports.size(); ++i) {
+                if (i != index) {
+                    co_await node->add_peer(mesh::Endpoint("127.0.0.1", ports[i]));
+                }
+            }
+
+            ++n_started;
+
+            int n_sent{};
+
+            while (!done) {
+                /* The first node broadcasts once everybody is up and the previous one has spread. */
+                if (index == 0 && n_started == int(ports.size()) && n_sent == n_broadcasts) {
+                    co_await node->broadcast(payload);
+                    ++n_sent;
+                }
+
+                co_await node->sleep_async(std::chrono::milliseconds(5));
+            }
+
+            n_duplicates[index] = node->dedup_stats().m_n_hits;
+
+            co_await node->stop();
+        };
+
+        auto task = run();
+
+        node->run_until(task);
+    };
+
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < ports.size(); ++i) {
+        threads.emplace_back(run_node, i);
+    }
+
+    auto wait_for = [&](int n) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+        while ((n_delivered[1] < n || n_delivered[2] < n) && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+
+        /* Let the forwarded copies and the prunes they cause arrive. */
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    };
+
+    wait_for(1);
+
+    /* The second broadcast goes down the pruned tree, the redundant link only carries an IHAVE. */
+    ++n_broadcasts;
+
+    wait_for(2);
+
+    done = true;
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    /* Delivered exactly once everywhere, the origin doesn't deliver its own message. */
+    EXPECT_EQ(n_delivered[0].load(), 0);
+    EXPECT_EQ(n_delivered[1].load(), 2);
+    EXPECT_EQ(n_delivered[2].load(), 2);
+
+    /* The first broadcast also crossed the link between 1 and 2 and was dropped as a
+     * duplicate there, which pruned the link. The second one didn't. */
+    EXPECT_EQ(n_duplicates[1] + n_duplicates[2], 2);
+}
+
+TEST_F(Socket_test, PeerTable) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    mesh::Peer_table table(4);
+    std::vector<mesh::Endpoint> endpoints;
+
+    /* Grows past the initial capacity, the ports share the address. */
+    for (uint16_t i = 0; i < 1000; ++i) {
+        endpoints.emplace_back("10.0." + std::to_string(i % 7) + ".1", uint16_t(20000 + i));
+
+        mesh::Peer peer;
+
+        peer.m_is_active = true;
+        peer.m_endpoint = endpoints.back();
+
+        EXPECT_TRUE(table.insert(peer));
+    }
+
+    EXPECT_FALSE(table.insert(table.peers()[10]));
+    EXPECT_EQ(table.size(), endpoints.size());
+
+    /* Erase every third one, the rest stay reachable and index aligned with their address. */
+    for (size_t i = 0; i < endpoints.size(); i += 3) {
+        EXPECT_TRUE(table.erase(mesh::Peer_table::key(endpoints[i].m_addr)));
+    }
+
+    for (size_t i = 0; i < endpoints.size(); ++i) {
+        const auto key = mesh::Peer_table::key(endpoints[i].m_addr);
+        const auto index = table.find(key);
+
+        if (i % 3 == 0) {
+            EXPECT_EQ(index, table.size());
+            EXPECT_FALSE(table.erase(key));
+        } else {
+            ASSERT_LT(index, table.size());
+            EXPECT_EQ(table.peers()[index].m_endpoint, endpoints[i]);
+            EXPECT_EQ(mesh::Peer_table::key(table.addrs()[index]), key);
+        }
+    }
+
+    EXPECT_EQ(table.size(), endpoints.size() - (endpoints.size() + 2) / 3);
+}
+
+TEST_F(Socket_test, RcuSnapshots) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    /* Every version holds n copies of n, a torn or freed version breaks that. */
+    mesh::Rcu<std::vector<size_t>> value(std::vector<size_t>(1, 1));
+    std::atomic<bool> done{false};
+    std::atomic<size_t> n_torn{0};
+    std::atomic<size_t> n_reads{0};
+    std::vector<std::thread> readers;
+
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&]() {
+            while (!done.load(std::memory_order_relaxed)) {
+                const auto snapshot = value.read();
+                const auto n = snapshot->size();
+
+                if (std::ranges::any_of(*snapshot, [n](size_t v) { return v != n; })) {
+                    n_torn.fetch_add(1, std::memory_order_relaxed);
+                }
+                n_reads.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    /* Publish while the readers are in the middle of reading. */
+    while (n_reads.load() < readers.size()) {
+        std::this_thread::yield();
+    }
+
+    for (size_t i = 2; i < 2000; ++i) {
+        EXPECT_TRUE(value.update([i](std::vector<size_t>& v) {
+            v.assign(i % 64 + 1, i % 64 + 1);
+            return true;
+        }));
+    }
+
+    done.store(true);
+
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_EQ(n_torn.load(), 0u);
+
+    /* Nested read sections, and a refused update publishes nothing. */
+    {
+        const auto outer = value.read();
+        const auto inner = value.read();
+
+        EXPECT_EQ(outer.m_value, inner.m_value);
+        EXPECT_FALSE(value.update([](std::vector<size_t>&) { return false; }));
+    }
+
+    /* With no readers left everything replaced is freed on the next publish. */
+    value.update([](std::vector<size_t>& v) {
+        v.assign(3, 3);
+        return true;
+    });
+
+    EXPECT_TRUE(value.m_retired.empty());
+    EXPECT_EQ(mesh::Epoch_domain::instance().min_epoch(), mesh::Epoch_domain::IDLE);
+}
+
+TEST_F(Socket_test, TimerWheel) {
+    Logger::get_instance().set_level(Logger::Level::WARN);
+
+    using namespace std::chrono;
+
+    const auto tick = milliseconds(10);
+    const auto start = steady_clock::now();
+    mesh::Timer_wheel wheel(tick, start);
+    std::unordered_map<mesh::Timer_wheel::Key, steady_clock::time_point> deadlines;
+
+    /* Spread over all the levels, up to past the top one. */
+    for (uint64_t key = 0; key < 2000; ++key) {
+        const auto deadline = start + milliseconds(key * key * 13 % 500'000'000);
+
+        wheel.schedule(key, deadline);
+        deadlines[key] = deadline;
+    }
+
+    /* Later deadlines are only stored, earlier ones relink. */
+    for (uint64_t key = 0; key < 2000; key += 3) {
+        deadlines[key] += milliseconds(key * 71);
+        EXPECT_TRUE(wheel.touch(key, deadlines[key]));
+    }
+
+    for (uint64_t key = 1; key < 2000; key += 7) {
+        deadlines[key] = start + milliseconds(key * 5);
+        wheel.schedule(key, deadlines[key]);
+    }
+
+    for (uint64_t key = 2; key < 2000; key += 11) {
+        EXPECT_TRUE(wheel.cancel(key));
+        deadlines.erase(key);
+    }
+
+    EXPECT_FALSE(wheel.touch(100'000, start));
+    EXPECT_EQ(wheel.size(), deadlines.size());
+
+    /* Irregular steps, every timer fires at or after its deadline and less than a tick late. */
+    std::vector<mesh::Timer_wheel::Key> expired;
+    auto now = start;
+
+    for (uint64_t step = 1; !deadlines.empty(); ++step) {
+        ASSERT_LT(step, 100'000u);
+
+        now += milliseconds(step % 17 * 9973 + 3);
+        expired.clear();
+
+        wheel.advance(now, expired);
+
+        for (const auto key : expired) {
+            auto it = deadlines.find(key);
+
+            ASSERT_NE(it, deadlines.end());
+            EXPECT_LE(it->second, now);
+            deadlines.erase(it);
+        }
+
+        for (const auto& [key, deadline] : deadlines) {
+            EXPECT_GT(deadline + tick, now);
+        }
+    }
+
+    EXPECT_EQ(wheel.size(), 0u);
+}
+
+TEST_F(Socket_test, Heartbeat) {
+    Logger::get_instance().set_level(Logger::Level::ERROR);
+
+    using namespace std::chrono;
+
+    /* The estimator: the first sample seeds it, steady samples pull the deviation down. */
+    mesh::Peer_stats stats;
+
+    stats.on_rtt(milliseconds(10));
+
+    EXPECT_DOUBLE_EQ(stats.m_rtt_ms, 10.0);
+    EXPECT_DOUBLE_EQ(stats.m_rtt_var_ms, 5.0);
+
+    stats.on_rtt(milliseconds(18));
+
+    EXPECT_DOUBLE_EQ(stats.m_rtt_var_ms, 5.0 + (8.0 - 5.0) / 4);
+    EXPECT_DOUBLE_EQ(stats.m_rtt_ms, 11.0);
+
+    for (int i = 0; i < 100; ++i) {
+        stats.on_rtt(milliseconds(11));
+    }
+
+    EXPECT_NEAR(stats.m_rtt_ms, 11.0, 0.01);
+    EXPECT_LT(stats.m_rtt_var_ms, 0.01);
+
+    for (int i = 0; i < 100; ++i) {
+        stats.on_probe(i % 4 != 0);
+    }
+
+    EXPECT_EQ(stats.m_n_probes, 100u);
+    EXPECT_EQ(stats.m_n_lost, 25u);
+    EXPECT_GT(stats.m_loss_rate, 0.1);
+    EXPECT_LT(stats.m_loss_rate, 0.4);
+
+    /* Two peers measuring each other over loopback, each on its own thread. */
+    constexpr std::array<uint16_t, 2> ports{12387, 12388};
+    std::array<std::optional<mesh::Peer_stats>, 2> measured{};
+    std::array<std::optional<mesh::Peer_stats>, 2> strangers{};
+    std::atomic<bool> done{};
+
+    auto run_node = [&](size_t index) {
+        auto node = std::make_shared<mesh::Node>(mesh::Endpoint("127.0.0.1", ports[index]));
+
+        /* A short interval keeps the test fast, loopback replies still come back well within it. */
+        node->set_heartbeat_interval(milliseconds(50));
+
+        auto run = [&]() -> udp::Task<mesh::Node*> {
+            co_await node->start();
+            co_await node->add_peer(mesh::Endpoint("127.0.0.1", ports[1 - index]));
+
+            const auto deadline = steady_clock::now() + seconds(5);
+
+            /* Published at the start of the round after the reply came back. */
+            while (!done && steady_clock::now() < deadline) {
+                if (const auto peer = node->peer_stats(mesh::Endpoint("127.0.0.1", ports[1 - index])); peer && peer->m_n_samples > 0) {
+                    measured[index] = peer;
+                    break;
+                }
+
+                co_await node->sleep_async(milliseconds(10));
+            }
+
+            /* Keep answering until both sides have their sample. */
+            while (!done) {
+                co_await node->sleep_async(milliseconds(10));
+            }
+
+            strangers[index] = node->peer_stats(mesh::Endpoint("127.0.0.1", 12399));
+
+            co_await node->stop();
+        };
+
+        auto task = run();
+
+        node->run_until(task);
+    };
+
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < ports.size(); ++i) {
+        threads.emplace_back(run_node, i);
+    }
+
+    const auto deadline = steady_clock::now() + seconds(5);
+
+    while (steady_clock::now() < deadline && !(measured[0].has_value() && measured[1].has_value())) {
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+
+    done = true;
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < ports.size(); ++i) {
+        ASSERT_TRUE(measured[i].has_value());
+        EXPECT_GT(measured[i]->m_rtt_ms, 0.0);
+        EXPECT_LT(measured[i]->m_rtt_ms, 1000.0);
+        EXPECT_GE(measured[i]->m_n_probes, 1u);
+        EXPECT_FALSE(strangers[i].has_value());
+    }
+}
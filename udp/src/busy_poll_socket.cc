@@ -0,0 +1,463 @@
+#include "libudp/busy_poll_socket.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <netinet/udp.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <liburing.h>
+
+namespace udp {
+
+  int Busy_poll_operation::reap(io_uring_cqe* cqe) {
+    /* Never posted to a ring. */
+    return cqe->res;
+  }
+
+  void Busy_poll_receive_operation::submit() {
+    m_socket->m_n_deadlines += has_deadline();
+    m_socket->m_receives.push_back(this);
+  }
+
+  void Busy_poll_send_operation::submit() {
+    m_socket->m_n_deadlines += has_deadline();
+    m_socket->m_sends.push_back(this);
+  }
+
+  /* Orders m_timers as a min-heap. */
+  static bool later(const Busy_poll_timer_operation* lhs, const Busy_poll_timer_operation* rhs) noexcept {
+    return lhs->m_deadline > rhs->m_deadline;
+  }
+
+  void Busy_poll_timer_operation::submit() {
+    auto& timers = m_socket->m_timers;
+
+    timers.push_back(this);
+    std::push_heap(timers.begin(), timers.end(), later);
+  }
+
+  Busy_poll_socket::Busy_poll_socket(uint16_t port, const Busy_poll_config& config)
+    : m_batch_size(std::clamp<size_t>(config.m_batch_size, 1, MAX_BATCH)) {
+
+    m_socket_fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+    if (m_socket_fd < 0) {
+      throw std::runtime_error("Failed to create socket");
+    }
+
+    {
+      int val{1};
+
+      setsockopt(m_socket_fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+      setsockopt(m_socket_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    }
+
+    if (config.m_busy_poll_us > 0) {
+      int val = int(config.m_busy_poll_us);
+
+      if (setsockopt(m_socket_fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)) < 0) {
+        log_warn("Failed to set SO_BUSY_POLL: ", strerror(errno));
+      }
+    }
+
+#ifdef SO_PREFER_BUSY_POLL
+    if (config.m_prefer_busy_poll) {
+      int val{1};
+
+      if (setsockopt(m_socket_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &val, sizeof(val)) < 0) {
+        log_warn("Failed to set SO_PREFER_BUSY_POLL: ", strerror(errno));
+      }
+    }
+#endif /* SO_PREFER_BUSY_POLL */
+
+    sockaddr_in addr{};
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    log_debug("Binding busy poll socket to port " + std::to_string(port));
+
+    if (::bind(m_socket_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+      close();
+      throw std::runtime_error("Failed to bind socket");
+    }
+  }
+
+  Busy_poll_socket::~Busy_poll_socket() {
+    close();
+  }
+
+  size_t Busy_poll_socket::cancel_all() {
+    /* Take them all off the queues first, the resumed awaiters may queue new ones. */
+    std::vector<Busy_poll_operation*> cancelled{};
+
+    cancelled.reserve(m_sends.size() + m_receives.size() + m_timers.size());
+
+    for (auto op : m_sends) {
+      for (auto i = op->m_next; i < op->m_datagrams.size(); ++i) {
+        op->m_datagrams[i].m_result = -ECANCELED;
+      }
+
+      cancelled.push_back(op);
+    }
+
+    cancelled.insert(cancelled.end(), m_receives.begin(), m_receives.end());
+    cancelled.insert(cancelled.end(), m_timers.begin(), m_timers.end());
+
+    m_sends.clear();
+    m_receives.clear();
+    m_timers.clear();
+    m_n_deadlines = 0;
+
+    for (auto op : cancelled) {
+      op->complete(-ECANCELED);
+    }
+
+    return cancelled.size();
+  }
+
+  void Busy_poll_socket::close() noexcept {
+    cancel_all();
+
+    if (m_socket_fd >= 0) {
+      ::close(m_socket_fd);
+      m_socket_fd = -1;
+    }
+  }
+
+  Task<int> Busy_poll_socket::receive_async(Buffer& buffer) {
+    Busy_poll_receive_operation op(this, buffer);
+
+    co_return co_await op;
+  }
+
+  Task<int> Busy_poll_socket::send_async(sockaddr_in addr, const void* data, int n_bytes, uint16_t segment_size) {
+    std::array<Outgoing_datagram, 1> datagrams{};
+
+    datagrams[0].m_addr = addr;
+    datagrams[0].m_data = data;
+    datagrams[0].m_n_bytes = n_bytes;
+
+    Busy_poll_send_operation op(this, datagrams, segment_size);
+
+    co_await op;
+
+    co_return datagrams[0].m_result;
+  }
+
+  Task<int> Busy_poll_socket::receive_async(Buffer& buffer, sockaddr_in& from) {
+    Busy_poll_receive_operation op(this, buffer);
+
+    const auto ret = co_await op;
+
+    from = op.m_from;
+
+    co_return ret;
+  }
+
+  Task<int> Busy_poll_socket::receive_async(Buffer& buffer, std::chrono::steady_clock::time_point deadline) {
+    Busy_poll_receive_operation op(this, buffer);
+
+    op.m_deadline = deadline;
+
+    co_return co_await op;
+  }
+
+  Task<int> Busy_poll_socket::send_async(sockaddr_in addr, const void* data, int n_bytes, std::chrono::steady_clock::time_point deadline) {
+    std::array<Outgoing_datagram, 1> datagrams{};
+
+    datagrams[0].m_addr = addr;
+    datagrams[0].m_data = data;
+    datagrams[0].m_n_bytes = n_bytes;
+
+    Busy_poll_send_operation op(this, datagrams);
+
+    op.m_deadline = deadline;
+
+    co_await op;
+
+    co_return datagrams[0].m_result;
+  }
+
+  Task<int> Busy_poll_socket::send_async(sockaddr_in addr, std::span<const iovec> iov) {
+    std::array<Outgoing_datagram, 1> datagrams{};
+
+    datagrams[0].m_addr = addr;
+    datagrams[0].m_iov = iov;
+
+    Busy_poll_send_operation op(this, datagrams);
+
+    co_await op;
+
+    co_return datagrams[0].m_result;
+  }
+
+  Task<int> Busy_poll_socket::send_async(sockaddr_in addr, std::span<const iovec> iov, std::chrono::steady_clock::time_point deadline) {
+    std::array<Outgoing_datagram, 1> datagrams{};
+
+    datagrams[0].m_addr = addr;
+    datagrams[0].m_iov = iov;
+
+    Busy_poll_send_operation op(this, datagrams);
+
+    op.m_deadline = deadline;
+
+    co_await op;
+
+    co_return datagrams[0].m_result;
+  }
+
+  Task<int> Busy_poll_socket::send_batch(std::span<Outgoing_datagram> datagrams) {
+    if (datagrams.empty()) {
+      co_return 0;
+    }
+
+    Busy_poll_send_operation op(this, datagrams);
+
+    co_return co_await op;
+  }
+
+  Task<int> Busy_poll_socket::sleep_async(std::chrono::nanoseconds duration) {
+    Busy_poll_timer_operation op(this, duration);
+
+    co_return co_await op;
+  }
+
+  size_t Busy_poll_socket::run_once() {
+    for (;;) {
+      if (const auto n_completed = poll(); n_completed > 0) {
+        return n_completed;
+      }
+
+      if (m_sends.empty() && m_receives.empty() && m_timers.empty()) {
+        return 0;
+      }
+    }
+  }
+
+  size_t Busy_poll_socket::poll() {
+    return poll_sends() + poll_receives() + poll_timers() + expire_deadlines() + poll_posted();
+  }
+
+  void Busy_poll_socket::post(std::coroutine_handle<> handle) {
+    std::lock_guard lock(m_posted_mutex);
+
+    m_posted.push_back(handle);
+    m_n_posted.fetch_add(1, std::memory_order_release);
+  }
+
+  size_t Busy_poll_socket::poll_posted() {
+    if (m_n_posted.load(std::memory_order_acquire) == 0) {
+      return 0;
+    }
+
+    std::vector<std::coroutine_handle<>> handles;
+
+    {
+      std::lock_guard lock(m_posted_mutex);
+
+      handles.swap(m_posted);
+      m_n_posted.fetch_sub(handles.size(), std::memory_order_relaxed);
+    }
+
+    for (auto handle : handles) {
+      handle.resume();
+    }
+
+    return handles.size();
+  }
+
+  void Busy_poll_socket::finish(Busy_poll_operation* op, int result) noexcept {
+    m_n_deadlines -= op->has_deadline();
+    op->complete(result);
+  }
+
+  size_t Busy_poll_socket::expire_deadlines() {
+    if (m_n_deadlines == 0) {
+      return 0;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+
+    /* Dequeue all of them before completing any, completions may queue new operations. */
+    std::array<Busy_poll_operation*, MAX_BATCH> expired;
+    size_t n_expired{};
+
+    for (auto it = m_receives.begin(); it != m_receives.end() && n_expired < expired.size();) {
+      if ((*it)->m_deadline <= now) {
+        expired[n_expired++] = *it;
+        it = m_receives.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    for (auto it = m_sends.begin(); it != m_sends.end() && n_expired < expired.size();) {
+      if (auto op = *it; op->m_deadline <= now) {
+        for (auto i = op->m_next; i < op->m_datagrams.size(); ++i) {
+          op->m_datagrams[i].m_result = -ETIMEDOUT;
+        }
+
+        expired[n_expired++] = op;
+        it = m_sends.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    for (size_t i = 0; i < n_expired; ++i) {
+      finish(expired[i], -ETIMEDOUT);
+    }
+
+    return n_expired;
+  }
+
+  size_t Busy_poll_socket::poll_timers() {
+    size_t n_completed{};
+
+    if (m_timers.empty()) {
+      return 0;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+
+    while (!m_timers.empty() && m_timers.front()->m_deadline <= now) {
+      auto op = m_timers.front();
+
+      std::pop_heap(m_timers.begin(), m_timers.end(), later);
+      m_timers.pop_back();
+
+      op->complete(0);
+      ++n_completed;
+    }
+
+    return n_completed;
+  }
+
+  size_t Busy_poll_socket::poll_sends() {
+    size_t n_completed{};
+
+    /* The scratch arrays are local, a resumed sender may poll the socket again. */
+    std::array<mmsghdr, MAX_BATCH> msgs;
+    std::array<iovec, MAX_BATCH> iovs;
+    alignas(cmsghdr) std::array<std::array<uint8_t, CMSG_SPACE(sizeof(uint16_t))>, MAX_BATCH> controls;
+
+    while (!m_sends.empty()) {
+      auto op = m_sends.front();
+      const auto n = std::min(m_batch_size, op->m_datagrams.size() - op->m_next);
+
+      for (size_t i = 0; i < n; ++i) {
+        auto& datagram = op->m_datagrams[op->m_next + i];
+        auto& msg = msgs[i].msg_hdr;
+
+        msg = {};
+        msg.msg_name = &datagram.m_addr;
+        msg.msg_namelen = sizeof(datagram.m_addr);
+
+        if (datagram.m_iov.empty()) {
+          iovs[i].iov_base = const_cast<void*>(datagram.m_data);
+          iovs[i].iov_len = size_t(datagram.m_n_bytes);
+
+          msg.msg_iov = &iovs[i];
+          msg.msg_iovlen = 1;
+        } else {
+          msg.msg_iov = const_cast<iovec*>(datagram.m_iov.data());
+          msg.msg_iovlen = datagram.m_iov.size();
+        }
+
+        if (op->m_segment_size > 0) {
+          msg.msg_control = controls[i].data();
+          msg.msg_controllen = controls[i].size();
+
+          auto cmsg = CMSG_FIRSTHDR(&msg);
+
+          cmsg->cmsg_level = SOL_UDP;
+          cmsg->cmsg_type = UDP_SEGMENT;
+          cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+          std::memcpy(CMSG_DATA(cmsg), &op->m_segment_size, sizeof(uint16_t));
+        }
+      }
+
+      const auto ret = ::sendmmsg(m_socket_fd, msgs.data(), unsigned(n), MSG_DONTWAIT);
+
+      if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        }
+
+        /* The first datagram failed, report it and move past it. */
+        op->m_datagrams[op->m_next++].m_result = -errno;
+      } else {
+        for (int i = 0; i < ret; ++i) {
+          op->m_datagrams[op->m_next++].m_result = int(msgs[i].msg_len);
+          ++op->m_n_sent;
+        }
+      }
+
+      if (op->m_next == op->m_datagrams.size()) {
+        m_sends.pop_front();
+        finish(op, op->m_n_sent);
+        ++n_completed;
+      }
+    }
+
+    return n_completed;
+  }
+
+  size_t Busy_poll_socket::poll_receives() {
+    if (m_receives.empty()) {
+      return 0;
+    }
+
+    std::array<mmsghdr, MAX_BATCH> msgs;
+    std::array<iovec, MAX_BATCH> iovs;
+    std::array<Busy_poll_receive_operation*, MAX_BATCH> ops;
+
+    const auto n = std::min(m_batch_size, m_receives.size());
+
+    for (size_t i = 0; i < n; ++i) {
+      auto& msg = msgs[i].msg_hdr;
+
+      ops[i] = m_receives[i];
+
+      iovs[i].iov_base = ops[i]->m_buffer.data();
+      iovs[i].iov_len = ops[i]->m_buffer.size();
+
+      msg = {};
+      msg.msg_name = &ops[i]->m_from;
+      msg.msg_namelen = sizeof(ops[i]->m_from);
+      msg.msg_iov = &iovs[i];
+      msg.msg_iovlen = 1;
+    }
+
+    const auto ret = ::recvmmsg(m_socket_fd, msgs.data(), unsigned(n), MSG_DONTWAIT, nullptr);
+
+    if (ret < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+
+      const auto error = -errno;
+
+      m_receives.pop_front();
+      finish(ops[0], error);
+
+      return 1;
+    }
+
+    /* Dequeue all of them before resuming any, a resumed receiver queues its next receive. */
+    m_receives.erase(m_receives.begin(), m_receives.begin() + ret);
+
+    for (int i = 0; i < ret; ++i) {
+      finish(ops[i], int(msgs[i].msg_len));
+    }
+
+    return size_t(ret);
+  }
+
+}  // namespace udp
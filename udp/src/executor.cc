@@ -0,0 +1,135 @@
+#include "libudp/executor.h"
+
+#include <algorithm>
+
+namespace udp {
+
+/* The executor and worker index of the thread, null on threads that are not workers */
+static thread_local const Executor* t_executor{};
+static thread_local size_t t_worker_index{};
+
+Executor::Executor(size_t n_workers) {
+  if (n_workers == 0) {
+    n_workers = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  m_running = true;
+
+  for (size_t i = 0; i < n_workers; ++i) {
+    m_workers.push_back(std::make_unique<Worker>());
+  }
+
+  /* Started once all the deques exist, the workers steal from each other. */
+  for (size_t i = 0; i < n_workers; ++i) {
+    m_workers[i]->m_thread = std::thread([this, i]() {
+      run(i);
+    });
+  }
+}
+
+Executor::~Executor() {
+  stop();
+}
+
+void Executor::post(std::coroutine_handle<> handle) {
+  const auto index = t_executor == this
+    ? t_worker_index
+    : m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+
+  {
+    auto& worker = *m_workers[index];
+    std::lock_guard lock(worker.m_mutex);
+
+    worker.m_queue.push_back(handle);
+  }
+
+  m_n_queued.fetch_add(1, std::memory_order_release);
+
+  /* Taking the mutex orders the increment before a sleeping worker's predicate check. */
+  {
+    std::lock_guard lock(m_idle_mutex);
+  }
+
+  m_idle_cv.notify_one();
+}
+
+std::coroutine_handle<> Executor::next(size_t index) {
+  {
+    auto& worker = *m_workers[index];
+    std::lock_guard lock(worker.m_mutex);
+
+    if (!worker.m_queue.empty()) {
+      /* LIFO on the own deque, the most recently posted frame is the hottest. */
+      auto handle = worker.m_queue.back();
+
+      worker.m_queue.pop_back();
+
+      return handle;
+    }
+  }
+
+  for (size_t i = 1; i < m_workers.size(); ++i) {
+    auto& victim = *m_workers[(index + i) % m_workers.size()];
+    std::lock_guard lock(victim.m_mutex);
+
+    if (!victim.m_queue.empty()) {
+      /* FIFO from the victim, the oldest work is the least likely to be in its cache. */
+      auto handle = victim.m_queue.front();
+
+      victim.m_queue.pop_front();
+      m_workers[index]->m_n_stolen.fetch_add(1, std::memory_order_relaxed);
+
+      return handle;
+    }
+  }
+
+  return nullptr;
+}
+
+void Executor::run(size_t index) {
+  t_executor = this;
+  t_worker_index = index;
+
+  auto& worker = *m_workers[index];
+
+  for (;;) {
+    if (auto handle = next(index); handle) {
+      m_n_queued.fetch_sub(1, std::memory_order_relaxed);
+      worker.m_n_executed.fetch_add(1, std::memory_order_relaxed);
+
+      handle.resume();
+
+      continue;
+    }
+
+    std::unique_lock lock(m_idle_mutex);
+
+    m_idle_cv.wait(lock, [this]() {
+      return m_n_queued.load(std::memory_order_acquire) > 0 || !m_running;
+    });
+
+    if (!m_running && m_n_queued.load(std::memory_order_acquire) == 0) {
+      break;
+    }
+  }
+
+  t_executor = nullptr;
+}
+
+void Executor::stop() noexcept {
+  {
+    std::lock_guard lock(m_idle_mutex);
+
+    m_running = false;
+  }
+
+  m_idle_cv.notify_all();
+
+  for (auto& worker : m_workers) {
+    if (worker->m_thread.joinable()) {
+      worker->m_thread.join();
+    }
+  }
+}
+
+} // namespace udp
@@ -0,0 +1,86 @@
+#include "libudp/frame_pool.h"
+
+#include <new>
+#include <utility>
+
+namespace udp {
+
+/* Set once the thread's pool is destroyed, frames freed after that (e.g. by static
+ * objects at exit) go back to the global allocator. */
+static thread_local bool t_is_pool_destroyed{};
+
+static size_t size_class(size_t n_bytes) noexcept {
+  return (n_bytes + Frame_pool::GRANULARITY - 1) / Frame_pool::GRANULARITY - 1;
+}
+
+Frame_pool::~Frame_pool() {
+  t_is_pool_destroyed = true;
+
+  for (auto& free_list : m_free_lists) {
+    while (free_list.m_head != nullptr) {
+      ::operator delete(std::exchange(free_list.m_head, free_list.m_head->m_next));
+    }
+  }
+}
+
+Frame_pool& Frame_pool::this_thread() noexcept {
+  thread_local Frame_pool pool;
+
+  return pool;
+}
+
+const Frame_pool::Stats& Frame_pool::stats() noexcept {
+  return this_thread().m_stats;
+}
+
+void* Frame_pool::allocate(size_t n_bytes) {
+  if (t_is_pool_destroyed) [[unlikely]] {
+    return ::operator new(n_bytes);
+  }
+
+  auto& pool = this_thread();
+
+  if (n_bytes > MAX_POOLED_SIZE) [[unlikely]] {
+    ++pool.m_stats.m_n_oversized;
+    return ::operator new(n_bytes);
+  }
+
+  const auto index = size_class(n_bytes);
+  auto& free_list = pool.m_free_lists[index];
+
+  if (free_list.m_head != nullptr) [[likely]] {
+    ++pool.m_stats.m_n_hits;
+    --free_list.m_n_blocks;
+
+    return std::exchange(free_list.m_head, free_list.m_head->m_next);
+  }
+
+  ++pool.m_stats.m_n_misses;
+
+  /* Allocate the whole class size, the block may be reused for any frame of the class. */
+  return ::operator new((index + 1) * GRANULARITY);
+}
+
+void Frame_pool::deallocate(void* ptr, size_t n_bytes) noexcept {
+  if (n_bytes > MAX_POOLED_SIZE || t_is_pool_destroyed) [[unlikely]] {
+    ::operator delete(ptr);
+    return;
+  }
+
+  auto& pool = this_thread();
+
+  auto& free_list = pool.m_free_lists[size_class(n_bytes)];
+
+  if (free_list.m_n_blocks == MAX_FREE_BLOCKS) {
+    ::operator delete(ptr);
+    return;
+  }
+
+  auto block = static_cast<Free_block*>(ptr);
+
+  block->m_next = free_list.m_head;
+  free_list.m_head = block;
+  ++free_list.m_n_blocks;
+}
+
+} // namespace udp
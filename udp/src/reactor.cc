@@ -0,0 +1,86 @@
+#include "libudp/reactor.h"
+
+#include <array>
+#include <stdexcept>
+
+#include <liburing.h>
+
+namespace udp {
+
+void Reactor::attach(io_uring* ring) noexcept {
+  m_ring = ring;
+  m_sq_tail_base = *m_ring->sq.ktail;
+  m_n_finished = 0;
+}
+
+uint32_t Reactor::in_flight() const noexcept {
+  /* The tail is only written by this thread, every SQE is flushed right away. Wraps
+   * around like the counters. */
+  return *m_ring->sq.ktail - m_sq_tail_base - m_n_finished;
+}
+
+size_t Reactor::poll() {
+  std::array<io_uring_cqe*, BATCH_SIZE> cqes;
+
+  auto n_cqes = io_uring_peek_batch_cqe(m_ring, cqes.data(), cqes.size());
+
+  if (n_cqes == 0 && (m_ring->flags & IORING_SETUP_DEFER_TASKRUN)) {
+    /* With deferred task run the kernel posts CQEs only when asked to. */
+    io_uring_get_events(m_ring);
+
+    n_cqes = io_uring_peek_batch_cqe(m_ring, cqes.data(), cqes.size());
+  }
+
+  if (n_cqes == 0) {
+    return 0;
+  }
+
+  /* Copy the CQEs and release the slots before resuming anything, a resumed
+   * coroutine may drive this reactor again and must not see the same CQEs. */
+  struct Completion {
+    IO_operation* m_operation;
+    io_uring_cqe m_cqe;
+  };
+
+  std::array<Completion, BATCH_SIZE> completions;
+
+  for (unsigned i = 0; i < n_cqes; ++i) {
+    completions[i].m_operation = static_cast<IO_operation*>(io_uring_cqe_get_data(cqes[i]));
+    completions[i].m_cqe.user_data = cqes[i]->user_data;
+    completions[i].m_cqe.res = cqes[i]->res;
+    completions[i].m_cqe.flags = cqes[i]->flags;
+
+    m_n_finished += !(cqes[i]->flags & IORING_CQE_F_MORE);
+  }
+
+  io_uring_cq_advance(m_ring, n_cqes);
+
+  for (unsigned i = 0; i < n_cqes; ++i) {
+    if (auto io_operation = completions[i].m_operation; io_operation != nullptr) [[likely]] {
+      log_debug(io_operation->type(), " completion queue event: ret: ", completions[i].m_cqe.res);
+      io_operation->on_completion(&completions[i].m_cqe);
+    }
+  }
+
+  return n_cqes;
+}
+
+size_t Reactor::run_once() {
+  if (const auto n_cqes = poll(); n_cqes > 0) {
+    return n_cqes;
+  }
+
+  int ret;
+  io_uring_cqe* cqe;
+
+  while ((ret = io_uring_wait_cqe(m_ring, &cqe)) == -EAGAIN || ret == -EINTR) {
+  }
+
+  if (ret < 0) [[unlikely]] {
+    throw std::runtime_error(std::string("io_uring_wait_cqe failed: ") + strerror(-ret));
+  }
+
+  return poll();
+}
+
+} // namespace udp
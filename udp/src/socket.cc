@@ -1,8 +1,11 @@
 #include "libudp/socket.h"
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <stdexcept>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -11,15 +14,33 @@
 namespace udp {
 
   bool IO_operation::await_suspend(any_handle handle) {
+    assert(!m_handle);
+
     m_handle = handle;
+    m_completed = false;
+
     submit();
+
     log_debug(type(), " submitted");
 
-    const auto ready = io_uring_cq_ready(m_ring) > 0;
+    return true;
+  }
+
+  void Notified_send_operation::on_completion(io_uring_cqe* cqe) {
+    if (cqe->flags & IORING_CQE_F_NOTIF) {
+      /* The kernel is done with the buffer. */
+      assert(m_has_send_result);
+      sent(m_send_result);
+      return;
+    }
 
-    log_debug(type(), " io_uring completion queue is ", ready ? "ready" : "not ready");
+    m_send_result = reap(cqe);
+    m_has_send_result = true;
 
-    return !ready;
+    /* Without F_MORE there is no notification to wait for: a copying send, or the send failed. */
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      sent(m_send_result);
+    }
   }
 
   void Send_operation::submit() {
@@ -34,14 +55,39 @@ namespace udp {
     std::memset(&m_msg_hdr, 0, sizeof(m_msg_hdr));
 
     m_msg_hdr.msg_iov = m_iov.data();
-    m_msg_hdr.msg_iovlen = m_iov.size();
+    m_msg_hdr.msg_iovlen = m_n_iov;
     m_msg_hdr.msg_namelen = sizeof(m_addr);
     m_msg_hdr.msg_name = reinterpret_cast<void*>(&m_addr);
 
-    io_uring_prep_sendmsg(sqe, m_fd, &m_msg_hdr, 0);
+    if (m_segment_size > 0) {
+      m_msg_hdr.msg_control = m_control.data();
+      m_msg_hdr.msg_controllen = m_control.size();
+
+      auto cmsg = CMSG_FIRSTHDR(&m_msg_hdr);
+
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+      std::memcpy(CMSG_DATA(cmsg), &m_segment_size, sizeof(m_segment_size));
+    }
+
+    if (m_zero_copy) {
+      io_uring_prep_sendmsg_zc(sqe, m_fd, &m_msg_hdr, 0);
+    } else {
+      io_uring_prep_sendmsg(sqe, m_fd, &m_msg_hdr, 0);
+    }
+
+    m_has_send_result = false;
+
+    sqe->flags |= m_sqe_flags;
 
     io_uring_sqe_set_data(sqe, this);
 
+    if (m_link_timeout != nullptr) {
+      m_link_timeout->link(m_ring, sqe);
+    }
+
     if (log_level_can_print(Logger::Level::DEBUG)) [[unlikely]] {
       std::string addr{inet_ntoa(m_addr.sin_addr)};
 
@@ -52,7 +98,7 @@ namespace udp {
     const auto ret = io_uring_submit(m_ring);
 
     if (ret < 0) {
-      log_error("Failed to submit ", type(), " operation: ", strerror(ret));
+      log_error("Failed to submit ", type(), " operation: ", strerror(-ret));
       throw std::runtime_error("Failed to submit " + std::string(type()) + " operation");
     }
   }
@@ -64,6 +110,147 @@ namespace udp {
     return ret;
   }
 
+  Batch_send_operation::Batch_send_operation(io_uring* ring, int fd, std::span<Outgoing_datagram> datagrams)
+    : IO_operation(ring, IO_operation::Type::SEND), m_fd(fd), m_datagrams(datagrams) {
+
+    m_slots.reserve(m_datagrams.size());
+
+    for (size_t i = 0; i < m_datagrams.size(); ++i) {
+      m_slots.emplace_back(ring, this, i);
+    }
+  }
+
+  void Batch_send_operation::Slot::submit() {
+    auto sqe = io_uring_get_sqe(m_ring);
+
+    if (sqe == nullptr) {
+      /* The SQ ring is full, hand what we have to the kernel and retry. */
+      const auto ret = io_uring_submit(m_ring);
+
+      if (ret < 0) {
+        log_error("Failed to submit ", type(), " operation: ", strerror(-ret));
+        throw std::runtime_error("Failed to submit " + std::string(type()) + " operation");
+      }
+
+      sqe = io_uring_get_sqe(m_ring);
+    }
+
+    if (sqe == nullptr) {
+      throw std::runtime_error(std::string(type()) + " failed to get SQE");
+    }
+
+    auto& datagram = m_batch->m_datagrams[m_index];
+
+    std::memset(&m_msg_hdr, 0, sizeof(m_msg_hdr));
+
+    if (datagram.m_iov.empty()) {
+      m_iov[0].iov_len = datagram.m_n_bytes;
+      m_iov[0].iov_base = const_cast<void*>(datagram.m_data);
+
+      m_msg_hdr.msg_iov = m_iov.data();
+      m_msg_hdr.msg_iovlen = m_iov.size();
+    } else {
+      /* The kernel only reads the iovecs, the batch's caller keeps them alive. */
+      m_msg_hdr.msg_iov = const_cast<iovec*>(datagram.m_iov.data());
+      m_msg_hdr.msg_iovlen = datagram.m_iov.size();
+    }
+    m_msg_hdr.msg_namelen = sizeof(datagram.m_addr);
+    m_msg_hdr.msg_name = reinterpret_cast<void*>(&datagram.m_addr);
+
+    /* No IOSQE_ASYNC, a UDP send rarely blocks and issuing inline avoids an io-wq hop per datagram. */
+    if (m_zero_copy) {
+      io_uring_prep_sendmsg_zc(sqe, m_batch->m_fd, &m_msg_hdr, 0);
+    } else {
+      io_uring_prep_sendmsg(sqe, m_batch->m_fd, &m_msg_hdr, 0);
+    }
+
+    m_has_send_result = false;
+
+    sqe->flags |= m_sqe_flags;
+
+    io_uring_sqe_set_data(sqe, this);
+  }
+
+  int Batch_send_operation::Slot::reap(io_uring_cqe* cqe) {
+    const auto ret = cqe->res;
+    assert(ret != -EAGAIN && ret != -EINTR);
+
+    return ret;
+  }
+
+  void Batch_send_operation::submit() {
+    for (auto& slot : m_slots) {
+      slot.submit();
+      ++m_n_pending;
+    }
+
+    const auto ret = io_uring_submit(m_ring);
+
+    if (ret < 0) {
+      log_error("Failed to submit ", type(), " operation: ", strerror(-ret));
+      throw std::runtime_error("Failed to submit " + std::string(type()) + " operation");
+    }
+  }
+
+  void Batch_send_operation::Slot::sent(int result) {
+    assert(m_batch->m_n_pending > 0);
+
+    m_batch->m_datagrams[m_index].m_result = result;
+
+    if (--m_batch->m_n_pending == 0) {
+      m_batch->complete(int(std::count_if(m_batch->m_datagrams.begin(), m_batch->m_datagrams.end(), [](const auto& datagram) {
+        return datagram.m_result >= 0;
+      })));
+    }
+  }
+
+  int Batch_send_operation::reap(io_uring_cqe*) {
+    /* The CQEs carry the slot as user_data, see Slot::reap(). */
+    assert(false);
+    return -EINVAL;
+  }
+
+  void Fixed_send_operation::submit() {
+    auto sqe = io_uring_get_sqe(m_ring);
+
+    if (sqe == nullptr) {
+      throw std::runtime_error(std::string(type()) + " failed to get SQE");
+    }
+
+    assert(m_buffer.is_valid());
+    assert(size_t(m_n_bytes) <= m_buffer.data().size());
+
+    m_has_send_result = false;
+
+    if (m_zero_copy) {
+      io_uring_prep_send_zc_fixed(sqe, m_fd, m_buffer.data().data(), m_n_bytes, 0, 0, m_buffer.m_buffer_index);
+    } else {
+      /* A copying send pins no pages, the registration doesn't buy anything, and
+       * IORING_OP_SEND rejects IORING_RECVSEND_FIXED_BUF. */
+      io_uring_prep_send(sqe, m_fd, m_buffer.data().data(), m_n_bytes, 0);
+    }
+
+    io_uring_prep_send_set_addr(sqe, reinterpret_cast<const sockaddr*>(&m_addr), sizeof(m_addr));
+
+    sqe->flags |= m_sqe_flags;
+
+    io_uring_sqe_set_data(sqe, this);
+
+    const auto ret = io_uring_submit(m_ring);
+
+    if (ret < 0) {
+      log_error("Failed to submit ", type(), " operation: ", strerror(-ret));
+      throw std::runtime_error("Failed to submit " + std::string(type()) + " operation");
+    }
+  }
+
+  int Fixed_send_operation::reap(io_uring_cqe* cqe) {
+    const auto ret = cqe->res;
+    assert(ret != -EAGAIN && ret != -EINTR);
+
+    return ret;
+  }
+
   void Receive_operation::submit() {
     auto sqe = io_uring_get_sqe(m_ring);
 
@@ -84,10 +271,21 @@ namespace udp {
     m_msg_hdr.msg_namelen = sizeof(m_client_addr);
     m_msg_hdr.msg_name = reinterpret_cast<void*>(&m_client_addr);
 
+    /* Zeroed so that reap() sees a cmsg_len of 0 if the kernel wrote nothing. */
+    m_control.fill(0);
+    m_msg_hdr.msg_control = m_control.data();
+    m_msg_hdr.msg_controllen = m_control.size();
+
     io_uring_prep_recvmsg(sqe, m_fd, &m_msg_hdr, 0);
 
+    sqe->flags |= m_sqe_flags;
+
     io_uring_sqe_set_data(sqe, this);
 
+    if (m_link_timeout != nullptr) {
+      m_link_timeout->link(m_ring, sqe);
+    }
+
     if (log_level_can_print(Logger::Level::DEBUG)) [[unlikely]] {
       std::string addr{inet_ntoa(m_client_addr.sin_addr)};
 
@@ -98,50 +296,363 @@ namespace udp {
     const auto ret = io_uring_submit(m_ring);
 
     if (ret < 0) {
-      log_error("Failed to submit ", type(), " operation: ", strerror(ret));
+      log_error("Failed to submit ", type(), " operation: ", strerror(-ret));
       throw std::runtime_error("Failed to submit " + std::string(type()) + " operation");
     }
   }
 
+  /**
+   * @return the UDP_GRO segment size if the control message is present, 0 otherwise.
+   */
+  static uint16_t gro_segment_size(const cmsghdr* cmsg) noexcept {
+    if (cmsg != nullptr && cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+      int segment_size{};
+
+      std::memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+
+      return uint16_t(segment_size);
+    }
+
+    return 0;
+  }
+
   int Receive_operation::reap(io_uring_cqe *cqe) {
     const auto ret = cqe->res;
     assert(ret != -EAGAIN && ret != -EINTR);
 
+    m_segment_size = 0;
+
+    if (ret > 0) {
+      for (auto cmsg = CMSG_FIRSTHDR(&m_msg_hdr); cmsg != nullptr && cmsg->cmsg_len > 0; cmsg = CMSG_NXTHDR(&m_msg_hdr, cmsg)) {
+        if (auto segment_size = gro_segment_size(cmsg); segment_size > 0) {
+          m_segment_size = segment_size;
+          break;
+        }
+      }
+    }
+
     return ret;
   }
 
-  int Completion_operation::reap(io_uring_cqe* cqe) {
-    int ret;
+  void Timeout_operation::submit() {
+    auto sqe = io_uring_get_sqe(m_ring);
 
-    if (auto io_operation = static_cast<IO_operation*>(io_uring_cqe_get_data(cqe)); io_operation != nullptr) [[likely]] {
-      log_debug(io_operation->type(), " completion queue event: ret: ", abs(cqe->res));
-      ret = io_operation->reap(cqe);
-      complete(ret);
+    if (sqe == nullptr) {
+      throw std::runtime_error(std::string(type()) + " failed to get SQE");
     }
 
-    io_uring_cqe_seen(m_ring, cqe);
+    io_uring_prep_timeout(sqe, &m_ts, 0, 0);
 
-    return ret;
+    io_uring_sqe_set_data(sqe, this);
+
+    if (const auto ret = io_uring_submit(m_ring); ret < 0) {
+      throw std::runtime_error("Failed to submit " + std::string(type()) + " operation");
+    }
+  }
+
+  int Timeout_operation::reap(io_uring_cqe* cqe) {
+    /* A pure timeout completes with -ETIME when it expires. */
+    return cqe->res == -ETIME ? 0 : cqe->res;
+  }
+
+  void Link_timeout_operation::link(io_uring* ring, io_uring_sqe* sqe) {
+    auto timeout_sqe = io_uring_get_sqe(ring);
+
+    if (timeout_sqe == nullptr) {
+      throw std::runtime_error(std::string(type()) + " failed to get SQE");
+    }
+
+    sqe->flags |= IOSQE_IO_LINK;
+
+    io_uring_prep_link_timeout(timeout_sqe, &m_ts, IORING_TIMEOUT_ABS);
+
+    io_uring_sqe_set_data(timeout_sqe, this);
+
+    m_completed = false;
+  }
+
+  int Link_timeout_operation::reap(io_uring_cqe* cqe) {
+    /* -ETIME if it fired, -ECANCELED if the operation completed first. */
+    return cqe->res;
+  }
+
+  void Cancel_operation::submit() {
+    auto sqe = io_uring_get_sqe(m_ring);
+
+    if (sqe == nullptr) {
+      throw std::runtime_error(std::string(type()) + " failed to get SQE");
+    }
+
+    io_uring_prep_cancel64(sqe, 0, IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL);
+
+    io_uring_sqe_set_data(sqe, this);
+
+    if (const auto ret = io_uring_submit(m_ring); ret < 0) {
+      throw std::runtime_error("Failed to submit " + std::string(type()) + " operation");
+    }
+  }
+
+  int Cancel_operation::reap(io_uring_cqe* cqe) {
+    return cqe->res;
+  }
+
+  Post_operation::Post_operation(io_uring* ring) : IO_operation(ring, IO_operation::Type::NONE) {
+    m_fd = ::eventfd(0, EFD_CLOEXEC);
+
+    if (m_fd < 0) {
+      throw std::runtime_error("Failed to create the post eventfd: " + std::string(strerror(errno)));
+    }
+  }
+
+  Post_operation::~Post_operation() {
+    ::close(m_fd);
+  }
+
+  void Post_operation::post(std::coroutine_handle<> handle) {
+    {
+      std::lock_guard lock(m_mutex);
+
+      m_handles.push_back(handle);
+    }
+
+    /* Writes coalesce in the eventfd counter, one read picks up everything queued. */
+    const uint64_t one{1};
+
+    if (::write(m_fd, &one, sizeof(one)) != sizeof(one)) {
+      log_error("Failed to wake the ring: ", strerror(errno));
+    }
+  }
+
+  void Post_operation::submit() {
+    auto sqe = io_uring_get_sqe(m_ring);
+
+    if (sqe == nullptr) {
+      throw std::runtime_error(std::string(type()) + " failed to get SQE");
+    }
+
+    io_uring_prep_read(sqe, m_fd, &m_value, sizeof(m_value), 0);
+
+    io_uring_sqe_set_data(sqe, this);
+
+    if (const auto ret = io_uring_submit(m_ring); ret < 0) {
+      throw std::runtime_error("Failed to submit " + std::string(type()) + " operation");
+    }
+
+    m_is_armed = true;
+  }
+
+  int Post_operation::reap(io_uring_cqe* cqe) {
+    return cqe->res;
+  }
+
+  void Post_operation::on_completion(io_uring_cqe* cqe) {
+    m_is_armed = false;
+
+    if (const auto ret = reap(cqe); ret < 0) {
+      /* Cancelled by cancel_all(), Socket::enable_post() rearms it. */
+      if (ret != -ECANCELED) {
+        log_error("Post eventfd read failed: ", strerror(-ret));
+      }
+      return;
+    }
+
+    std::vector<std::coroutine_handle<>> handles;
+
+    {
+      std::lock_guard lock(m_mutex);
+
+      handles.swap(m_handles);
+    }
+
+    /* Rearmed first, a resumed coroutine may post again or cancel everything. */
+    submit();
+
+    for (auto handle : handles) {
+      handle.resume();
+    }
+  }
+
+  Registered_buffer_pool::Registered_buffer_pool(io_uring* ring, uint16_t n_buffers, uint32_t buffer_size)
+    : m_ring(ring), m_n_buffers(n_buffers), m_buffer_size(buffer_size), m_storage(size_t(n_buffers) * buffer_size) {
+
+    std::vector<iovec> iovecs(m_n_buffers);
+
+    for (uint16_t i = 0; i < m_n_buffers; ++i) {
+      iovecs[i].iov_base = m_storage.data() + size_t(i) * m_buffer_size;
+      iovecs[i].iov_len = m_buffer_size;
+    }
+
+    if (const auto ret = io_uring_register_buffers(m_ring, iovecs.data(), iovecs.size()); ret < 0) {
+      throw std::runtime_error(std::string("Failed to register buffers: ") + strerror(-ret));
+    }
+
+    /* Hand out the low indexes first. */
+    m_free.reserve(m_n_buffers);
+
+    for (uint16_t i = m_n_buffers; i > 0; --i) {
+      m_free.push_back(uint16_t(i - 1));
+    }
+  }
+
+  Registered_buffer_pool::~Registered_buffer_pool() {
+    io_uring_unregister_buffers(m_ring);
+  }
+
+  Registered_buffer Registered_buffer_pool::acquire() noexcept {
+    if (m_free.empty()) {
+      return {};
+    }
+
+    const auto buffer_index = m_free.back();
+
+    m_free.pop_back();
+
+    return {this, buffer_index, {m_storage.data() + size_t(buffer_index) * m_buffer_size, m_buffer_size}};
+  }
+
+  Buffer_ring::Buffer_ring(io_uring* ring, uint16_t group_id, uint32_t n_buffers, uint32_t buffer_size)
+    : m_ring(ring), m_group_id(group_id), m_n_buffers(n_buffers), m_buffer_size(buffer_size) {
+
+    if (n_buffers == 0 || n_buffers > 32768 || (n_buffers & (n_buffers - 1)) != 0) {
+      throw std::runtime_error("Buffer ring size must be a power of 2 <= 32768: " + std::to_string(n_buffers));
+    }
+
+    int ret{};
+
+    m_buf_ring = io_uring_setup_buf_ring(m_ring, m_n_buffers, m_group_id, 0, &ret);
+
+    if (m_buf_ring == nullptr) {
+      throw std::runtime_error(std::string("Failed to register buffer ring: ") + strerror(-ret));
+    }
+
+    m_storage.resize(size_t(m_n_buffers) * m_buffer_size);
+
+    const auto mask = io_uring_buf_ring_mask(m_n_buffers);
+
+    for (uint32_t i = 0; i < m_n_buffers; ++i) {
+      auto buf = buffer(uint16_t(i));
+      io_uring_buf_ring_add(m_buf_ring, buf.data(), buf.size(), uint16_t(i), mask, int(i));
+    }
+
+    io_uring_buf_ring_advance(m_buf_ring, int(m_n_buffers));
+  }
+
+  Buffer_ring::~Buffer_ring() {
+    if (m_buf_ring != nullptr) {
+      io_uring_free_buf_ring(m_ring, m_buf_ring, m_n_buffers, m_group_id);
+    }
+  }
+
+  void Buffer_ring::recycle(uint16_t buffer_id) noexcept {
+    auto buf = buffer(buffer_id);
+
+    io_uring_buf_ring_add(m_buf_ring, buf.data(), buf.size(), buffer_id, io_uring_buf_ring_mask(m_n_buffers), 0);
+    io_uring_buf_ring_advance(m_buf_ring, 1);
+  }
+
+  void Multishot_receive_operation::submit() {
+    /* Waiting on an armed receive only waits for its next completion, taking an
+     * SQE here would leave it unprepared for the next submit to send. */
+    if (m_is_armed) {
+      return;
+    }
+
+    auto sqe = io_uring_get_sqe(m_ring);
+
+    if (sqe == nullptr) {
+      throw std::runtime_error(std::string(type()) + " failed to get SQE");
+    }
+
+    assert(m_fd >= 0);
+
+    std::memset(&m_msg_hdr, 0, sizeof(m_msg_hdr));
+
+    /* The kernel lays out io_uring_recvmsg_out, the name and the payload in the selected buffer. */
+    m_msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    m_msg_hdr.msg_controllen = GRO_CONTROL_SIZE;
+
+    io_uring_prep_recvmsg_multishot(sqe, m_fd, &m_msg_hdr, 0);
+
+    /* No IOSQE_ASYNC here, punting to io-wq would defeat the poll driven multishot. */
+    sqe->flags |= IOSQE_BUFFER_SELECT | m_sqe_flags;
+    sqe->buf_group = m_buffer_ring.m_group_id;
+
+    io_uring_sqe_set_data(sqe, this);
+
+    const auto ret = io_uring_submit(m_ring);
+
+    if (ret < 0) {
+      log_error("Failed to submit ", type(), " operation: ", strerror(-ret));
+      throw std::runtime_error("Failed to submit " + std::string(type()) + " operation");
+    }
+
+    m_is_armed = true;
   }
 
-  void Completion_operation::submit() {
-    int ret;
-    io_uring_cqe* cqe;
+  int Multishot_receive_operation::reap(io_uring_cqe* cqe) {
+    const auto ret = cqe->res;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      /* The kernel terminated the multishot, e.g. -ENOBUFS, it has to be armed again. */
+      m_is_armed = false;
+    }
+
+    if (ret < 0) {
+      return ret;
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) [[unlikely]] {
+      log_error(type(), " completion without a selected buffer");
+      return -EINVAL;
+    }
+
+    const auto buffer_id = uint16_t(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    auto buf = m_buffer_ring.buffer(buffer_id);
+    auto out = io_uring_recvmsg_validate(buf.data(), ret, &m_msg_hdr);
+
+    if (out == nullptr) [[unlikely]] {
+      m_buffer_ring.recycle(buffer_id);
+      return -EINVAL;
+    }
+
+    sockaddr_in from{};
+
+    std::memcpy(&from, io_uring_recvmsg_name(out), std::min<size_t>(out->namelen, sizeof(from)));
+
+    auto payload = static_cast<const uint8_t*>(io_uring_recvmsg_payload(out, &m_msg_hdr));
+    const auto n_bytes = io_uring_recvmsg_payload_length(out, ret, &m_msg_hdr);
 
-    while ((ret = io_uring_wait_cqe(m_ring, &cqe)) == -EAGAIN || ret == -EINTR) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (out->flags & MSG_TRUNC) [[unlikely]] {
+      log_warn(type(), " datagram truncated to ", n_bytes, " bytes, increase the buffer size");
     }
 
-    if (ret < 0) [[unlikely]] {
-      throw std::runtime_error(std::string("io_uring_wait_cqe failed: ") + strerror(-ret));
+    uint16_t segment_size{};
+
+    for (auto cmsg = io_uring_recvmsg_cmsg_firsthdr(out, &m_msg_hdr); cmsg != nullptr; cmsg = io_uring_recvmsg_cmsg_nexthdr(out, &m_msg_hdr, cmsg)) {
+      if ((segment_size = gro_segment_size(cmsg)) > 0) {
+        break;
+      }
     }
 
-    reap(cqe);
+    m_ready.emplace_back(&m_buffer_ring, buffer_id, std::span<const uint8_t>(payload, n_bytes), from, segment_size);
+
+    return int(n_bytes);
+  }
+
+  void Multishot_receive_operation::on_completion(io_uring_cqe* cqe) {
+    const auto ret = reap(cqe);
+
+    if (m_handle) {
+      complete(ret);
+    } else if (ret < 0) {
+      m_error = ret;
+    }
   }
 
-  Socket::Socket(uint16_t port) : m_socket_fd(-1), m_is_initialized(false) {
+  Socket::Socket(uint16_t port, const Socket_config& config) : m_socket_fd(-1), m_is_initialized(false) {
 
     m_ring = std::make_unique<io_uring>();
+    m_reactor.m_ring = m_ring.get();
 
     m_socket_fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
 
@@ -169,22 +680,104 @@ namespace udp {
       throw std::runtime_error("Failed to bind socket");
     }
 
-    {
-      int ret = io_uring_queue_init(32, m_ring.get(), 0);
+    if (const auto ret = init_ring(config); ret < 0) {
+      close();
+      throw std::runtime_error(std::string("Failed to initialize io_uring: ") + strerror(-ret));
+    }
 
-      if (ret < 0) {
-        close();
-        throw std::runtime_error(std::string("Failed to initialize io_uring: ") + strerror(-ret));
+    m_reactor.attach(m_ring.get());
+
+    m_is_initialized = true;
+  }
+
+  int Socket::init_ring(const Socket_config& config) {
+    uint32_t flags{};
+
+    if (config.m_cq_size > 0) {
+      flags |= IORING_SETUP_CQSIZE;
+    }
+
+    if (config.m_sqpoll) {
+      flags |= IORING_SETUP_SQPOLL;
+
+      if (config.m_sqpoll_cpu >= 0) {
+        flags |= IORING_SETUP_SQ_AFF;
+      }
+
+      if (config.m_coop_taskrun || config.m_defer_taskrun) {
+        /* The kernel rejects them with SQPOLL, there is no submitter task to defer to. */
+        log_warn("Task run flags are ignored with SQPOLL");
+      }
+    } else {
+      if (config.m_coop_taskrun) {
+        flags |= IORING_SETUP_COOP_TASKRUN;
+      }
+
+      if (config.m_defer_taskrun) {
+        flags |= IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
       }
     }
 
-    /* Start the completion processing thread. */
-    m_is_initialized = true;
+    if (config.m_single_issuer) {
+      flags |= IORING_SETUP_SINGLE_ISSUER;
+    }
+
+    /* Dropped in this order when the kernel rejects the setup, newest features first. */
+    constexpr uint32_t optional_flags[] = {
+      IORING_SETUP_DEFER_TASKRUN,
+      IORING_SETUP_SINGLE_ISSUER,
+      IORING_SETUP_COOP_TASKRUN,
+      IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF,
+      IORING_SETUP_CQSIZE
+    };
+
+    for (auto optional = std::begin(optional_flags);; ++optional) {
+      io_uring_params params{};
+
+      params.flags = flags;
+      params.cq_entries = config.m_cq_size;
+      params.sq_thread_idle = config.m_sqpoll_idle_ms;
+      params.sq_thread_cpu = config.m_sqpoll_cpu >= 0 ? uint32_t(config.m_sqpoll_cpu) : 0;
+
+      const auto ret = io_uring_queue_init_params(config.m_ring_depth, m_ring.get(), &params);
+
+      if (ret == 0) {
+        m_ring_flags = flags;
+        return 0;
+      }
+
+      /* EPERM: SQPOLL needs privileges on older kernels. */
+      if (ret != -EINVAL && ret != -EPERM) {
+        return ret;
+      }
+
+      while (optional != std::end(optional_flags) && !(flags & *optional)) {
+        ++optional;
+      }
+
+      if (optional == std::end(optional_flags)) {
+        return ret;
+      }
+
+      log_warn("io_uring setup with flags 0x", std::hex, flags, std::dec, " failed: ", strerror(-ret), ", retrying without 0x", std::hex, *optional);
+
+      flags &= ~*optional;
+    }
   }
 
   Socket& Socket::operator=(Socket&& rhs) noexcept {
     if (this != &rhs) {
       m_ring = std::move(rhs.m_ring);
+      m_reactor = rhs.m_reactor;
+      m_ring_flags = rhs.m_ring_flags;
+      m_is_fixed_file = rhs.m_is_fixed_file;
+      m_zero_copy_send = rhs.m_zero_copy_send;
+      m_zero_copy_supported = rhs.m_zero_copy_supported;
+      m_zero_copy_min_bytes = rhs.m_zero_copy_min_bytes;
+      m_send_buffers = std::move(rhs.m_send_buffers);
+      m_buffer_ring = std::move(rhs.m_buffer_ring);
+      m_multishot_receive = std::move(rhs.m_multishot_receive);
+      m_post = std::move(rhs.m_post);
       m_socket_fd = rhs.m_socket_fd;
       m_is_initialized = rhs.m_is_initialized;
 
@@ -198,36 +791,404 @@ namespace udp {
     close();
   }
 
-  Task<int> Socket::send_async(const std::string& address, uint16_t port, const void* data, int n_bytes) {
-    sockaddr_in addr{};
+  bool resolve(const std::string& address, uint16_t port, sockaddr_in& addr) noexcept {
+    addr = {};
 
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
 
-    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) <= 0) {
+    return inet_pton(AF_INET, address.c_str(), &addr.sin_addr) > 0;
+  }
+
+  Task<int> Socket::resend_copying(Notified_send_operation& op, Link_timeout_operation* timeout) {
+    log_warn("Zero-copy send not supported on this socket, falling back to copying sends");
+
+    m_zero_copy_send = false;
+    m_zero_copy_supported = false;
+    op.m_zero_copy = false;
+
+    const auto ret = co_await op;
+
+    if (timeout != nullptr) {
+      co_await timeout->reaped();
+    }
+
+    co_return ret;
+  }
+
+  Task<int> Socket::resend_copying(Batch_send_operation& op) {
+    std::vector<Outgoing_datagram> rejected{};
+    std::vector<size_t> indexes{};
+
+    for (const auto& slot : op.m_slots) {
+      if (slot.m_zero_copy && op.m_datagrams[slot.m_index].m_result == -EOPNOTSUPP) {
+        rejected.push_back(op.m_datagrams[slot.m_index]);
+        indexes.push_back(slot.m_index);
+      }
+    }
+
+    if (!rejected.empty()) {
+      log_warn("Zero-copy send not supported on this socket, falling back to copying sends");
+
+      m_zero_copy_send = false;
+      m_zero_copy_supported = false;
+
+      Batch_send_operation resend(m_ring.get(), sqe_fd(), rejected);
+
+      for (auto& slot : resend.m_slots) {
+        slot.m_sqe_flags = sqe_flags();
+      }
+
+      co_await resend;
+
+      for (size_t i = 0; i < rejected.size(); ++i) {
+        op.m_datagrams[indexes[i]].m_result = rejected[i].m_result;
+      }
+    }
+
+    co_return int(std::count_if(op.m_datagrams.begin(), op.m_datagrams.end(), [](const auto& datagram) {
+      return datagram.m_result >= 0;
+    }));
+  }
+
+  Task<int> Socket::send_async(const std::string& address, uint16_t port, const void* data, int n_bytes, uint16_t segment_size) {
+    sockaddr_in addr;
+
+    if (!resolve(address, port, addr)) {
       throw std::runtime_error("Invalid address");
     }
 
-    Send_operation op(m_ring.get(), m_socket_fd, data, n_bytes, addr);
+    return send_async(addr, data, n_bytes, segment_size);
+  }
+
+  Task<int> Socket::send_async(sockaddr_in addr, const void* data, int n_bytes, uint16_t segment_size) {
+    Send_operation op(m_ring.get(), sqe_fd(), data, n_bytes, addr, segment_size, use_zero_copy(n_bytes));
+
+    op.m_sqe_flags = sqe_flags();
+
+    auto ret = co_await op;
+
+    if (op.m_zero_copy && ret == -EOPNOTSUPP) [[unlikely]] {
+      ret = co_await resend_copying(op);
+    }
+
+    co_return ret;
+  }
+
+  Task<int> Socket::send_async(sockaddr_in addr, const void* data, int n_bytes, std::chrono::steady_clock::time_point deadline) {
+    Send_operation op(m_ring.get(), sqe_fd(), data, n_bytes, addr, 0, use_zero_copy(n_bytes));
+    Link_timeout_operation timeout(deadline);
+
+    op.m_sqe_flags = sqe_flags();
+    op.m_link_timeout = &timeout;
+
+    auto ret = co_await op;
+
+    co_await timeout.reaped();
+
+    if (op.m_zero_copy && ret == -EOPNOTSUPP) [[unlikely]] {
+      ret = co_await resend_copying(op, &timeout);
+    }
+
+    co_return ret == -ECANCELED && timeout.is_expired() ? -ETIMEDOUT : ret;
+  }
+
+  Task<int> Socket::send_async(sockaddr_in addr, std::span<const iovec> iov) {
+    if (iov.size() > Send_operation::MAX_IOVECS) {
+      co_return -EINVAL;
+    }
+
+    Send_operation op(m_ring.get(), sqe_fd(), iov, addr, use_zero_copy(int(iov_length(iov))));
+
+    op.m_sqe_flags = sqe_flags();
+
+    auto ret = co_await op;
+
+    if (op.m_zero_copy && ret == -EOPNOTSUPP) [[unlikely]] {
+      ret = co_await resend_copying(op);
+    }
+
+    co_return ret;
+  }
+
+  Task<int> Socket::send_async(sockaddr_in addr, std::span<const iovec> iov, std::chrono::steady_clock::time_point deadline) {
+    if (iov.size() > Send_operation::MAX_IOVECS) {
+      co_return -EINVAL;
+    }
+
+    Send_operation op(m_ring.get(), sqe_fd(), iov, addr, use_zero_copy(int(iov_length(iov))));
+    Link_timeout_operation timeout(deadline);
+
+    op.m_sqe_flags = sqe_flags();
+    op.m_link_timeout = &timeout;
+
+    auto ret = co_await op;
+
+    co_await timeout.reaped();
+
+    if (op.m_zero_copy && ret == -EOPNOTSUPP) [[unlikely]] {
+      ret = co_await resend_copying(op, &timeout);
+    }
+
+    co_return ret == -ECANCELED && timeout.is_expired() ? -ETIMEDOUT : ret;
+  }
+
+  Task<int> Socket::send_batch(std::span<Outgoing_datagram> datagrams) {
+    if (datagrams.empty()) {
+      co_return 0;
+    }
+
+    Batch_send_operation op(m_ring.get(), sqe_fd(), datagrams);
+
+    bool is_zero_copy{};
+
+    for (auto& slot : op.m_slots) {
+      slot.m_sqe_flags = sqe_flags();
+      slot.m_zero_copy = use_zero_copy(datagrams[slot.m_index].n_bytes());
+      is_zero_copy |= slot.m_zero_copy;
+    }
 
-    co_await op;
+    auto ret = co_await op;
 
-    Completion_operation completion(m_ring.get());
+    if (is_zero_copy && size_t(ret) < datagrams.size()) [[unlikely]] {
+      ret = co_await resend_copying(op);
+    }
 
-    co_return co_await completion;
+    co_return ret;
   }
 
   Task<int> Socket::receive_async(Buffer& buffer) {
-    Receive_operation op(m_ring.get(), m_socket_fd, buffer);
+    Receive_operation op(m_ring.get(), sqe_fd(), buffer);
+
+    op.m_sqe_flags = sqe_flags();
+
+    co_return co_await op;
+  }
+
+  Task<int> Socket::receive_async(Buffer& buffer, sockaddr_in& from) {
+    Receive_operation op(m_ring.get(), sqe_fd(), buffer);
+
+    op.m_sqe_flags = sqe_flags();
+
+    const auto ret = co_await op;
+
+    from = op.m_client_addr;
+
+    co_return ret;
+  }
 
-    co_await op;
+  Task<int> Socket::receive_async(Buffer& buffer, std::chrono::steady_clock::time_point deadline) {
+    Receive_operation op(m_ring.get(), sqe_fd(), buffer);
+    Link_timeout_operation timeout(deadline);
 
-    Completion_operation completion(m_ring.get());
+    op.m_sqe_flags = sqe_flags();
+    op.m_link_timeout = &timeout;
 
-    co_return co_await completion;
+    const auto ret = co_await op;
+
+    /* The timeout's CQE references it, it must be reaped before the frame goes away. */
+    co_await timeout.reaped();
+
+    co_return ret == -ECANCELED && timeout.is_expired() ? -ETIMEDOUT : ret;
+  }
+
+  Task<int> Socket::receive_async(Buffer& buffer, Datagram_segments& segments) {
+    Receive_operation op(m_ring.get(), sqe_fd(), buffer);
+
+    op.m_sqe_flags = sqe_flags();
+
+    const auto ret = co_await op;
+
+    if (ret >= 0) {
+      segments = Datagram_segments(std::span<const uint8_t>(buffer.data(), size_t(ret)), op.m_segment_size);
+    } else {
+      segments = {};
+    }
+
+    co_return ret;
+  }
+
+  void Socket::enable_gro() {
+    int val{1};
+
+    if (setsockopt(m_socket_fd, SOL_UDP, UDP_GRO, &val, sizeof(val)) < 0) {
+      throw std::runtime_error(std::string("Failed to enable UDP_GRO: ") + strerror(errno));
+    }
+  }
+
+  void Socket::enable_multishot_receive(uint32_t n_buffers, uint32_t buffer_size) {
+    assert(m_is_initialized);
+    assert(!m_multishot_receive);
+
+    m_buffer_ring = std::make_unique<Buffer_ring>(m_ring.get(), 0, n_buffers, buffer_size);
+    m_multishot_receive = std::make_unique<Multishot_receive_operation>(m_ring.get(), sqe_fd(), *m_buffer_ring);
+    m_multishot_receive->m_sqe_flags = sqe_flags();
+  }
+
+  bool Socket::enable_zero_copy_send(uint32_t min_bytes) {
+    assert(m_is_initialized);
+
+    auto probe = io_uring_get_probe_ring(m_ring.get());
+
+    m_zero_copy_send = probe != nullptr && io_uring_opcode_supported(probe, IORING_OP_SENDMSG_ZC);
+    m_zero_copy_min_bytes = min_bytes;
+
+    if (probe != nullptr) {
+      io_uring_free_probe(probe);
+    }
+
+    if (!m_zero_copy_send) {
+      log_warn("IORING_OP_SENDMSG_ZC not supported, using copying sends");
+    }
+
+    return m_zero_copy_send;
+  }
+
+  uint8_t Socket::sqe_flags() const noexcept {
+    return m_is_fixed_file ? IOSQE_FIXED_FILE : 0;
+  }
+
+  void Socket::enable_registered_resources(uint16_t n_buffers, uint32_t buffer_size) {
+    assert(m_is_initialized);
+    assert(!m_is_fixed_file);
+    assert(!m_multishot_receive || !m_multishot_receive->m_is_armed);
+
+    if (const auto ret = io_uring_register_files(m_ring.get(), &m_socket_fd, 1); ret < 0) {
+      throw std::runtime_error(std::string("Failed to register the socket fd: ") + strerror(-ret));
+    }
+
+    m_is_fixed_file = true;
+
+    if (m_multishot_receive) {
+      m_multishot_receive->m_fd = sqe_fd();
+      m_multishot_receive->m_sqe_flags = sqe_flags();
+    }
+
+    /* Kernels before IORING_OP_SEND_ZC fail it with EINVAL, not EOPNOTSUPP. */
+    if (auto probe = io_uring_get_probe_ring(m_ring.get()); probe != nullptr) {
+      m_zero_copy_supported = io_uring_opcode_supported(probe, IORING_OP_SEND_ZC);
+      io_uring_free_probe(probe);
+    }
+
+    m_send_buffers = std::make_unique<Registered_buffer_pool>(m_ring.get(), n_buffers, buffer_size);
+  }
+
+  Task<int> Socket::send_async(const std::string& address, uint16_t port, const Registered_buffer& buffer, int n_bytes) {
+    sockaddr_in addr;
+
+    if (!resolve(address, port, addr)) {
+      throw std::runtime_error("Invalid address");
+    }
+
+    return send_async(addr, buffer, n_bytes);
+  }
+
+  Task<int> Socket::send_async(sockaddr_in addr, const Registered_buffer& buffer, int n_bytes) {
+    Fixed_send_operation op(m_ring.get(), sqe_fd(), buffer, n_bytes, addr, m_zero_copy_supported);
+
+    op.m_sqe_flags = sqe_flags();
+
+    auto ret = co_await op;
+
+    if (op.m_zero_copy && ret == -EOPNOTSUPP) [[unlikely]] {
+      ret = co_await resend_copying(op);
+    }
+
+    co_return ret;
+  }
+
+  Task<int> Socket::sleep_async(std::chrono::nanoseconds duration) {
+    Timeout_operation op(m_ring.get(), duration);
+
+    co_return co_await op;
+  }
+
+  Task<int> Socket::receive_async(Datagram_lease& lease) {
+    assert(m_multishot_receive);
+
+    auto& op = *m_multishot_receive;
+
+    for (;;) {
+      if (!op.m_ready.empty()) {
+        lease = std::move(op.m_ready.front());
+        op.m_ready.pop_front();
+
+        co_return int(lease.data().size());
+      }
+
+      if (op.m_error < 0) {
+        co_return std::exchange(op.m_error, 0);
+      }
+
+      /* Arms the multishot if the kernel terminated it, then waits for the next datagram. */
+      const auto ret = co_await op;
+
+      if (ret < 0 && op.m_ready.empty()) {
+        co_return ret;
+      }
+    }
+  }
+
+  size_t Socket::cancel_all() {
+    size_t n_cancelled{};
+
+    for (size_t round = 0; m_reactor.in_flight() > 0; ++round) {
+      if (round == MAX_CANCEL_ROUNDS) {
+        log_warn(m_reactor.in_flight(), " operations still in flight after ", round, " rounds of cancellation");
+        break;
+      }
+
+      Cancel_operation op(m_ring.get());
+
+      op.submit();
+
+      /* Dispatches the CQEs of the cancelled operations too, their awaiters resume
+       * with -ECANCELED. They may submit new operations, the next round gets those. */
+      while (!op.m_completed) {
+        m_reactor.run_once();
+      }
+
+      if (op.m_result > 0) {
+        n_cancelled += size_t(op.m_result);
+      } else if (op.m_result == -ENOENT && m_reactor.in_flight() > 0) {
+        /* Already cancelled, only their CQEs are missing. */
+        m_reactor.run_once();
+      }
+    }
+
+    return n_cancelled;
+  }
+
+  void Socket::enable_post() {
+    if (!m_post) {
+      m_post = std::make_unique<Post_operation>(m_ring.get());
+    }
+
+    if (!m_post->m_is_armed) {
+      m_post->submit();
+    }
   }
 
   void Socket::close() noexcept {
+    if (m_is_initialized) {
+      /* The kernel must be done with the operations before their frames or buffers go away. */
+      try {
+        cancel_all();
+      } catch (const std::exception& e) {
+        log_error("Failed to cancel the operations in flight: ", e.what());
+      }
+    }
+
+    if (m_multishot_receive) {
+      /* Leased buffers must not outlive the socket, drop the ones nobody claimed. */
+      m_multishot_receive->m_ready.clear();
+      m_multishot_receive.reset();
+    }
+
+    m_buffer_ring.reset();
+    m_send_buffers.reset();
+    m_post.reset();
+
     if (m_is_initialized) {
       io_uring_queue_exit(m_ring.get());
     }
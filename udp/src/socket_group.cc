@@ -0,0 +1,206 @@
+#include "libudp/socket_group.h"
+
+#include <linux/filter.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <liburing.h>
+
+namespace udp {
+
+/* Reads the shard's eventfd, completes when Socket_group::stop() writes to it. Nobody
+ * awaits it, Socket_group::run() checks m_completed after every reactor round. */
+struct Wakeup_operation : public IO_operation {
+  Wakeup_operation(io_uring* ring, int fd) noexcept : IO_operation(ring, IO_operation::Type::RECEIVE), m_fd(fd) {}
+
+  void submit() override {
+    auto sqe = io_uring_get_sqe(m_ring);
+
+    if (sqe == nullptr) {
+      throw std::runtime_error(std::string(type()) + " failed to get SQE");
+    }
+
+    io_uring_prep_read(sqe, m_fd, &m_value, sizeof(m_value), 0);
+
+    io_uring_sqe_set_data(sqe, this);
+
+    if (const auto ret = io_uring_submit(m_ring); ret < 0) {
+      throw std::runtime_error("Failed to submit " + std::string(type()) + " operation");
+    }
+  }
+
+  int reap(io_uring_cqe* cqe) override {
+    return cqe->res;
+  }
+
+  int m_fd{-1};
+  uint64_t m_value{};
+};
+
+Socket_group::Socket_group(uint16_t port, Handler handler, const Socket_group_config& config)
+  : m_port(port), m_handler(std::move(handler)), m_config(config) {
+
+  auto n_shards = m_config.m_n_shards;
+
+  if (n_shards == 0) {
+    n_shards = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  for (size_t i = 0; i < n_shards; ++i) {
+    auto shard = std::make_unique<Shard>();
+
+    shard->m_index = i;
+    shard->m_cpu = m_config.m_cpus.empty() ? int(i) : m_config.m_cpus[i % m_config.m_cpus.size()];
+
+    m_shards.push_back(std::move(shard));
+  }
+}
+
+Socket_group::~Socket_group() {
+  stop();
+}
+
+void Socket_group::start() {
+  assert(!m_running);
+
+  m_running = true;
+
+  for (auto& shard : m_shards) {
+    shard->m_wakeup_fd = eventfd(0, EFD_CLOEXEC);
+
+    if (shard->m_wakeup_fd < 0) {
+      stop();
+      throw std::runtime_error(std::string("Failed to create eventfd: ") + strerror(errno));
+    }
+
+    std::promise<void> started;
+    auto future = started.get_future();
+
+    shard->m_thread = std::thread([this, &shard = *shard, &started]() {
+      run(shard, started);
+    });
+
+    /* The reuseport group indexes the sockets in bind order, keep it equal to the shard index. */
+    try {
+      future.get();
+    } catch (...) {
+      stop();
+      throw;
+    }
+  }
+
+  if (m_config.m_steer_by_cpu) {
+    attach_steering_program();
+  }
+}
+
+void Socket_group::stop() noexcept {
+  m_running = false;
+
+  for (auto& shard : m_shards) {
+    if (shard->m_wakeup_fd >= 0) {
+      const uint64_t value{1};
+
+      if (::write(shard->m_wakeup_fd, &value, sizeof(value)) < 0) {
+        log_error("Failed to wake up shard ", shard->m_index, ": ", strerror(errno));
+      }
+    }
+
+    if (shard->m_thread.joinable()) {
+      shard->m_thread.join();
+    }
+
+    if (shard->m_wakeup_fd >= 0) {
+      ::close(shard->m_wakeup_fd);
+      shard->m_wakeup_fd = -1;
+    }
+  }
+}
+
+void Socket_group::attach_steering_program() {
+  /* A = receiving CPU % number of sockets, the kernel uses A as the socket index. */
+  sock_filter code[] = {
+    {BPF_LD | BPF_W | BPF_ABS, 0, 0, uint32_t(SKF_AD_OFF + SKF_AD_CPU)},
+    {BPF_ALU | BPF_MOD | BPF_K, 0, 0, uint32_t(m_shards.size())},
+    {BPF_RET | BPF_A, 0, 0, 0},
+  };
+
+  sock_fprog program{};
+
+  program.len = std::size(code);
+  program.filter = code;
+
+  /* Attaching to one socket applies it to the whole reuseport group. */
+  const auto fd = m_shards.front()->m_socket->m_socket_fd;
+
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) < 0) {
+    log_warn("Failed to attach the reuseport CPU steering program: ", strerror(errno));
+  }
+}
+
+void Socket_group::run(Shard& shard, std::promise<void>& started) {
+  try {
+    if (shard.m_cpu >= 0) {
+      cpu_set_t cpus;
+
+      CPU_ZERO(&cpus);
+      CPU_SET(shard.m_cpu, &cpus);
+
+      if (const auto ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus); ret != 0) {
+        log_warn("Failed to pin shard ", shard.m_index, " to CPU ", shard.m_cpu, ": ", strerror(ret));
+      }
+    }
+
+    /* Created on this thread, the ring may be set up with SINGLE_ISSUER. */
+    shard.m_socket = std::make_unique<Socket>(m_port, m_config.m_socket_config);
+    shard.m_socket->enable_multishot_receive(m_config.m_n_buffers, m_config.m_buffer_size);
+  } catch (...) {
+    started.set_exception(std::current_exception());
+    return;
+  }
+
+  started.set_value();
+
+  auto& socket = *shard.m_socket;
+
+  try {
+    Wakeup_operation wakeup(socket.m_ring.get(), shard.m_wakeup_fd);
+
+    wakeup.submit();
+
+    Datagram_lease lease;
+    auto receive_task = socket.receive_async(lease);
+
+    receive_task.start();
+
+    while (m_running && !wakeup.m_completed) {
+      socket.m_reactor.run_once();
+
+      while (receive_task.is_done()) {
+        if (const auto ret = receive_task.get_result(); ret >= 0) {
+          ++shard.m_n_received;
+          m_handler(shard.m_index, socket, lease);
+        } else if (ret != -ENOBUFS) {
+          /* -ENOBUFS: the buffers were all leased out, the next receive re-arms. */
+          log_error("Shard ", shard.m_index, " receive failed: ", strerror(-ret));
+        }
+
+        lease.release();
+
+        /* Completes right away if more datagrams were queued by the same reactor round. */
+        receive_task = socket.receive_async(lease);
+        receive_task.start();
+      }
+    }
+
+    /* Resume the receive with -ECANCELED before its frame goes away. */
+    socket.cancel_all();
+  } catch (const std::exception& e) {
+    log_error("Shard ", shard.m_index, " failed: ", e.what());
+  }
+
+  shard.m_socket.reset();
+}
+
+} // namespace udp